@@ -0,0 +1,62 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Directory Cache Implementation @file
+
+#include "dir_cache.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static bool same_time(const struct timespec &a, const struct timespec &b)
+{
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+
+shared_ptr<const hs::dir_snapshot> hs::dir_cache::get(const fs::path &dir)
+{
+  const string &path = dir.string();
+  struct stat st;
+  if (stat(path.c_str(), &st) || !S_ISDIR(st.st_mode)) {
+    return make_shared<dir_snapshot>();
+  }
+
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_dirs.find(path);
+  if (it != m_dirs.end() && it->second.stable && same_time(it->second.mtime, st.st_mtim)) {
+    return it->second.snapshot;
+  }
+
+  // a change within the same mtime tick as the listing would go unnoticed so
+  // a listing is only trusted once the clock has moved past the mtime
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  auto snapshot = make_shared<dir_snapshot>();
+  DIR *d = opendir(path.c_str());
+  if (d) {
+    struct dirent *de;
+    while ((de = readdir(d))) {
+      if (de->d_name[0] == '.' && (de->d_name[1] == 0
+                                   || (de->d_name[1] == '.' && de->d_name[2] == 0))) {
+        continue;
+      }
+      snapshot->files.insert(de->d_name);
+    }
+    closedir(d);
+  }
+
+  entry &e = m_dirs[path];
+  e.mtime = st.st_mtim;
+  e.stable = now.tv_sec > st.st_mtim.tv_sec + 1;
+  e.snapshot = snapshot;
+  return snapshot;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Directory Cache @file
+
+#ifndef hindsight_admin_dir_cache_h_
+#define hindsight_admin_dir_cache_h_
+
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <boost/filesystem.hpp>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+struct dir_snapshot {
+  bool has(const std::string &fn) const { return files.find(fn) != files.end(); }
+
+  std::unordered_set<std::string> files;
+};
+
+
+/**
+ * Server wide cache of directory listings (the run/<type> and load/<type>
+ * plugin directories). A listing is reused until the directory mtime changes
+ * so checking the state of any number of plugins costs one stat per
+ * directory.
+ */
+class dir_cache {
+public:
+  /**
+   * Returns the current listing of a directory (empty if it does not exist).
+   */
+  std::shared_ptr<const dir_snapshot> get(const boost::filesystem::path &dir);
+
+private:
+  struct entry {
+    struct timespec                     mtime;
+    bool                                stable; // listed after the mtime tick
+    std::shared_ptr<const dir_snapshot> snapshot;
+  };
+
+  std::mutex                              m_mutex;
+  std::unordered_map<std::string, entry>  m_dirs;
+};
+
+}
+}
+}
+#endif
@@ -0,0 +1,158 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight File Watcher Implementation @file
+
+#include "file_watcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Wt/WLogger>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+hs::file_watcher::file_watcher() :
+    m_fd(-1),
+    m_next_id(0)
+{
+  m_pipe[0] = -1;
+  m_pipe[1] = -1;
+}
+
+
+hs::file_watcher::~file_watcher()
+{
+  stop();
+}
+
+
+void hs::file_watcher::start()
+{
+  if (m_fd >= 0) {
+    return;
+  }
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0) {
+    throw runtime_error(string("inotify_init1 failed: ") + strerror(errno));
+  }
+  if (pipe2(m_pipe, O_CLOEXEC)) {
+    close(m_fd);
+    m_fd = -1;
+    throw runtime_error(string("pipe2 failed: ") + strerror(errno));
+  }
+  m_thread = thread(&file_watcher::run, this);
+}
+
+
+void hs::file_watcher::stop()
+{
+  if (m_fd < 0) {
+    return;
+  }
+  char c = 0;
+  if (write(m_pipe[1], &c, 1) != 1) {
+    Wt::log("error") << "file_watcher could not signal shutdown";
+  }
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  close(m_pipe[0]);
+  close(m_pipe[1]);
+  close(m_fd);
+  m_pipe[0] = m_pipe[1] = m_fd = -1;
+  m_watchers.clear();
+}
+
+
+int hs::file_watcher::watch(const fs::path &dir, uint32_t mask, const callback &cb)
+{
+  lock_guard<recursive_mutex> lock(m_mutex);
+  if (m_fd < 0) {
+    return -1;
+  }
+  int wd = inotify_add_watch(m_fd, dir.string().c_str(), mask | IN_MASK_ADD);
+  if (wd < 0) {
+    Wt::log("error") << "inotify_add_watch failed: " << dir.string() << " "
+        << strerror(errno);
+    return -1;
+  }
+  watcher w = { wd, mask, cb };
+  m_watchers[++m_next_id] = w;
+  return m_next_id;
+}
+
+
+void hs::file_watcher::unwatch(int id)
+{
+  lock_guard<recursive_mutex> lock(m_mutex);
+  auto it = m_watchers.find(id);
+  if (it == m_watchers.end()) {
+    return;
+  }
+  int wd = it->second.wd;
+  m_watchers.erase(it);
+  for (auto wi = m_watchers.begin(); wi != m_watchers.end(); ++wi) {
+    if (wi->second.wd == wd) {
+      return;
+    }
+  }
+  inotify_rm_watch(m_fd, wd);
+}
+
+
+void hs::file_watcher::run()
+{
+  vector<char> buf(64 * 1024);
+  struct pollfd fds[2] = {
+    { m_fd, POLLIN, 0 },
+    { m_pipe[0], POLLIN, 0 }
+  };
+
+  for (;;) {
+    int ret = poll(fds, 2, -1);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      Wt::log("error") << "file_watcher poll failed: " << strerror(errno);
+      return;
+    }
+    if (fds[1].revents) {
+      return;
+    }
+
+    ssize_t len = read(m_fd, &buf[0], buf.size());
+    if (len <= 0) {
+      continue;
+    }
+
+    lock_guard<recursive_mutex> lock(m_mutex);
+    for (char *p = &buf[0]; p < &buf[0] + len;) {
+      const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + ev->len;
+      string name(ev->len ? ev->name : "");
+
+      // copy the matching callbacks so they are free to (un)watch
+      vector<callback> cbs;
+      for (auto it = m_watchers.begin(); it != m_watchers.end(); ++it) {
+        if ((ev->mask & IN_Q_OVERFLOW)
+            || (it->second.wd == ev->wd && (it->second.mask & ev->mask))) {
+          cbs.push_back(it->second.cb);
+        }
+      }
+      for (auto it = cbs.begin(); it != cbs.end(); ++it) {
+        (*it)(name, ev->mask);
+      }
+    }
+  }
+}
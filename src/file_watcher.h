@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight File Watcher @file
+
+#ifndef hindsight_admin_file_watcher_h_
+#define hindsight_admin_file_watcher_h_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Server wide inotify dispatcher. Callbacks are invoked on the watcher thread
+ * with the name of the directory entry and the inotify event mask; they must
+ * return quickly and hand any session work off with WServer::post.
+ */
+class file_watcher {
+public:
+  typedef std::function<void(const std::string &name, uint32_t mask)> callback;
+
+  file_watcher();
+  ~file_watcher();
+
+  void start();
+  void stop();
+
+  int watch(const boost::filesystem::path &dir, uint32_t mask, const callback &cb);
+  void unwatch(int id);
+
+private:
+  struct watcher {
+    int       wd;
+    uint32_t  mask;
+    callback  cb;
+  };
+
+  void run();
+
+  int                       m_fd;
+  int                       m_pipe[2];
+  int                       m_next_id;
+  std::map<int, watcher>    m_watchers;
+  std::recursive_mutex      m_mutex;
+  std::thread               m_thread;
+};
+
+}
+}
+}
+#endif
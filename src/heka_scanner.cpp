@@ -0,0 +1,321 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Heka Stream Scanner Implementation @file
+
+#include "heka_scanner.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Wt/WLogger>
+#include <luasandbox/util/protobuf.h>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const char g_record_separator = 0x1e;
+static const char g_unit_separator = 0x1f;
+static const size_t g_read_back_block = 4 * 1024 * 1024;
+static const size_t g_bisect_linear = 64 * 1024; // then scan in order
+
+
+static bool read_message_length(const char *p, const char *e, size_t max, size_t *len)
+{
+  // the whole header must parse, not just the length field, which makes a
+  // separator inside a message payload much less likely to pass for a frame
+  int tag = 0;
+  int wiretype = 0;
+  long long vi;
+  bool found = false;
+  while (p < e) {
+    p = lsb_pb_read_key(p, &tag, &wiretype);
+    if (!p || tag == 0) return false;
+    if (wiretype == LSB_PB_WT_VARINT) {
+      p = lsb_pb_read_varint(p, e, &vi);
+      if (!p) return false;
+      if (tag == 1) {
+        if (found || vi <= 0 || static_cast<unsigned long long>(vi) > max) return false;
+        *len = static_cast<size_t>(vi);
+        found = true;
+      }
+    } else if (wiretype == LSB_PB_WT_LENGTH) {
+      p = lsb_pb_read_varint(p, e, &vi);
+      if (!p || vi < 0 || vi > e - p) return false;
+      p += vi;
+    } else {
+      return false;
+    }
+  }
+  return found && p == e;
+}
+
+
+hs::heka_frame hs::parse_heka_frame(const char *p, const char *e, size_t max_message_size,
+                                    const char **msg, size_t *len)
+{
+  if (p >= e || *p != g_record_separator) {
+    return frame_invalid;
+  }
+  if (e - p < 2) {
+    return frame_incomplete;
+  }
+  size_t hlen = static_cast<unsigned char>(p[1]);
+  const char *hdr = p + 2;
+  if (hlen == 0) {
+    return frame_invalid;
+  }
+  if (static_cast<size_t>(e - hdr) <= hlen) {
+    return frame_incomplete;
+  }
+  if (hdr[hlen] != g_unit_separator
+      || !read_message_length(hdr, hdr + hlen, max_message_size, len)) {
+    return frame_invalid;
+  }
+  const char *m = hdr + hlen + 1;
+  if (static_cast<size_t>(e - m) < *len) {
+    return frame_incomplete;
+  }
+  *msg = m;
+  return frame_valid;
+}
+
+
+hs::heka_scanner::heka_scanner() :
+    m_data(nullptr),
+    m_size(0),
+    m_pos(0),
+    m_offset(0),
+    m_discarded(0),
+    m_max_message_size(0),
+    m_read_back(0),
+    m_mapped(false) { }
+
+
+hs::heka_scanner::~heka_scanner()
+{
+  close();
+}
+
+
+bool hs::heka_scanner::open(const fs::path &fn, size_t max_message_size)
+{
+  close();
+  m_max_message_size = max_message_size;
+
+  int fd = ::open(fn.string().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Wt::log("error") << "heka_scanner open failed: " << fn.string() << " " << strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    Wt::log("error") << "heka_scanner stat failed: " << fn.string() << " " << strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    ::close(fd);
+    return true;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    Wt::log("error") << "heka_scanner mmap failed: " << fn.string() << " " << strerror(errno);
+    return false;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  m_data = static_cast<const char *>(map);
+  m_size = size;
+  m_read_back = size;
+  m_mapped = true;
+  return true;
+}
+
+
+void hs::heka_scanner::open(const char *data, size_t size, size_t max_message_size)
+{
+  close();
+  m_data = data;
+  m_size = size;
+  m_max_message_size = max_message_size;
+  m_read_back = size;
+}
+
+
+void hs::heka_scanner::close()
+{
+  if (m_mapped) {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+  m_mapped = false;
+  m_data = nullptr;
+  m_size = 0;
+  m_pos = 0;
+  m_offset = 0;
+  m_discarded = 0;
+  m_read_back = 0;
+}
+
+
+bool hs::heka_scanner::next(lsb_heka_message *m)
+{
+  const char *e = m_data + m_size;
+  while (m_pos < m_size) {
+    const char *p = static_cast<const char *>(memchr(m_data + m_pos, g_record_separator,
+                                                      m_size - m_pos));
+    if (!p) {
+      m_discarded += m_size - m_pos;
+      m_pos = m_size;
+      break;
+    }
+    m_discarded += p - (m_data + m_pos);
+    m_pos = p - m_data;
+
+    const char *msg = nullptr;
+    size_t len = 0;
+    heka_frame f = parse_heka_frame(p, e, m_max_message_size, &msg, &len);
+    if (f == frame_incomplete) {
+      break;
+    }
+    if (f == frame_valid && lsb_decode_heka_message(m, msg, len, NULL)) {
+      m_offset = m_pos;
+      m_pos = msg + len - m_data;
+      return true;
+    }
+    ++m_discarded; // not a frame, resume after the separator
+    ++m_pos;
+  }
+  return false;
+}
+
+
+bool hs::heka_scanner::prev(lsb_heka_message *m, size_t floor)
+{
+  // record separator, header length, header, unit separator and message
+  const size_t max_frame = 2 + UCHAR_MAX + 1 + m_max_message_size;
+  size_t limit = m_pos; // the frame must end at or before it
+  size_t end = m_pos;   // frame starts at or past it were looked at already
+  while (end > floor) {
+    size_t lo = end - floor > max_frame ? end - max_frame : floor;
+    read_back(lo);
+    size_t at = end;
+    size_t nearest = limit; // end of the nearest complete frame
+    while (at > lo) {
+      const char *p = static_cast<const char *>(memrchr(m_data + lo, g_record_separator,
+                                                         at - lo));
+      if (!p) break;
+      at = p - m_data;
+
+      const char *msg = nullptr;
+      size_t len = 0;
+      if (parse_heka_frame(p, m_data + limit, m_max_message_size, &msg, &len) != frame_valid) {
+        continue;
+      }
+      size_t fe = msg + len - m_data;
+      if (fe == limit) {
+        if (lsb_decode_heka_message(m, msg, len, NULL)) {
+          m_pos = m_offset = at;
+          return true;
+        }
+        nearest = at; // not a message, skip the frame
+        break;
+      }
+      if (nearest == limit) nearest = fe;
+    }
+    if (nearest < limit) {
+      if (limit < m_size) m_discarded += limit - nearest; // else a frame being written
+      limit = end = nearest;
+    } else {
+      end = lo; // keep looking for a frame ending at or before limit
+    }
+  }
+  m_discarded += limit - floor;
+  m_pos = floor;
+  return false;
+}
+
+
+void hs::heka_scanner::read_back(size_t offset)
+{
+  // walking back defeats the kernel read ahead, prefetch a block at a time
+  if (offset >= m_read_back) return;
+  static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  size_t from = offset > g_read_back_block ? offset - g_read_back_block : 0;
+  uintptr_t b = reinterpret_cast<uintptr_t>(m_data + from) & ~(page - 1);
+  uintptr_t e = reinterpret_cast<uintptr_t>(m_data + m_read_back);
+  madvise(reinterpret_cast<void *>(b), e - b, MADV_WILLNEED);
+  m_read_back = from;
+}
+
+
+size_t hs::heka_scanner::find_frame(size_t offset) const
+{
+  static const int chain = 4; // consecutive frames that must line up
+  const char *e = m_data + m_size;
+  while (offset < m_size) {
+    const char *p = static_cast<const char *>(memchr(m_data + offset, g_record_separator,
+                                                      m_size - offset));
+    if (!p) break;
+
+    const char *n = p;
+    int i = 0;
+    for (; i < chain && n < e; ++i) {
+      const char *msg = nullptr;
+      size_t len = 0;
+      heka_frame f = parse_heka_frame(n, e, m_max_message_size, &msg, &len);
+      if (f == frame_invalid) break;
+      if (f == frame_incomplete) {
+        n = e;
+        break;
+      }
+      n = msg + len;
+    }
+    if (i == chain || (i > 0 && n == e)) {
+      return p - m_data;
+    }
+    offset = p - m_data + 1;
+  }
+  return m_size;
+}
+
+
+size_t hs::heka_scanner::find_timestamp(int64_t ts, size_t begin, size_t end,
+                                        lsb_heka_message *m)
+{
+  if (end > m_size) end = m_size;
+  size_t lo = begin; // every message before lo is older than ts
+  size_t hi = end;
+  while (hi - lo > g_bisect_linear) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t f = find_frame(mid);
+    m_pos = f;
+    if (f < hi && next(m) && m_offset < hi && m->timestamp < ts) {
+      lo = m_pos;
+    } else {
+      hi = mid;
+    }
+  }
+
+  m_pos = lo;
+  while (next(m) && m_offset < end) {
+    if (m->timestamp >= ts) {
+      m_pos = m_offset;
+      return m_offset;
+    }
+  }
+  m_pos = end;
+  return end;
+}
@@ -0,0 +1,152 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Heka Stream Scanner @file
+
+#ifndef hindsight_admin_heka_scanner_h_
+#define hindsight_admin_heka_scanner_h_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+#include <luasandbox/util/heka_message.h>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Walks the Heka framing of a queue file (N.log) in place. The file is
+ * mapped read only and the record separators are located with memchr so a
+ * scan is bound by the disk rather than by read calls; decoded messages are
+ * views into the mapping and stay valid until the scanner is closed. Only
+ * the frames complete at open time are visible.
+ */
+class heka_scanner {
+public:
+  heka_scanner();
+  ~heka_scanner();
+
+  heka_scanner(const heka_scanner &) = delete;
+  heka_scanner& operator=(const heka_scanner &) = delete;
+
+  /**
+   * Maps the file, any previously open file is closed.
+   *
+   * @param fn Path of the queue file
+   * @param max_message_size Frames announcing a larger message are skipped
+   *
+   * @return bool False if the file could not be opened or mapped
+   */
+  bool open(const boost::filesystem::path &fn, size_t max_message_size);
+
+  /**
+   * Scans memory owned by someone else (i.e. another scanner's mapping, so
+   * several threads can walk different ranges of one file).
+   */
+  void open(const char *data, size_t size, size_t max_message_size);
+  void close();
+
+  /**
+   * Decodes the next valid message, corrupt frames are skipped and counted
+   * in discarded().
+   *
+   * @param m Receives the message (views into the mapping)
+   *
+   * @return bool False at the end of the mapped data, position() is then
+   *         left at the start of a trailing incomplete frame if any
+   */
+  bool next(lsb_heka_message *m);
+
+  /**
+   * Decodes the message preceding position() walking back towards the start
+   * of the data: the frame ending exactly at position() or, when the data
+   * there is corrupt (or position() is inside a frame being written), the
+   * nearest complete frame before it. The cost is proportional to how far
+   * back the message is.
+   *
+   * @param m Receives the message (views into the mapping)
+   * @param floor Frames starting before this offset are not considered
+   *
+   * @return bool False once floor is reached, otherwise position() and
+   *         offset() are left at the start of the frame
+   */
+  bool prev(lsb_heka_message *m, size_t floor = 0);
+
+  /**
+   * Positions the scan at an arbitrary offset; the next call to next() resumes
+   * at the first frame starting at or after it, prev() at the last frame
+   * ending at or before it.
+   */
+  void seek(size_t offset) { m_pos = offset < m_size ? offset : m_size; }
+
+  /**
+   * Locates the first frame boundary at or after offset without decoding: a
+   * run of valid frames that lines up (up to the end of the data), so a
+   * separator inside a message payload is not mistaken for a boundary.
+   *
+   * @return size_t Offset of the frame or size() if there is none
+   */
+  size_t find_frame(size_t offset) const;
+
+  /**
+   * Bisects [begin, end) for the first message with a timestamp at or after
+   * ts, assuming the file is (roughly) in timestamp order: each probe
+   * resynchronises with find_frame and decodes a single message so only a
+   * handful of pages are touched, the last few KB are walked in order.
+   *
+   * @param begin Frame boundary to start from
+   * @param m Scratch message
+   *
+   * @return size_t Offset of the message or end if there is none
+   */
+  size_t find_timestamp(int64_t ts, size_t begin, size_t end, lsb_heka_message *m);
+
+  size_t position() const { return m_pos; }
+  size_t offset() const { return m_offset; } // of the last message returned
+  size_t size() const { return m_size; }
+  size_t discarded() const { return m_discarded; }
+  const char* data() const { return m_data; }
+
+private:
+  void read_back(size_t offset);
+
+  const char  *m_data;
+  size_t      m_size;
+  size_t      m_pos;
+  size_t      m_offset;
+  size_t      m_discarded;
+  size_t      m_max_message_size;
+  size_t      m_read_back;  // lowest offset prefetched by prev()
+  bool        m_mapped;
+};
+
+enum heka_frame {
+  frame_invalid,
+  frame_incomplete, // valid so far but runs past the end of the data
+  frame_valid
+};
+
+/**
+ * Validates the Heka frame starting at p (record separator, header length,
+ * header, unit separator).
+ *
+ * @param p Start of the frame (the 0x1E byte)
+ * @param e One past the end of the available data
+ * @param max_message_size Largest acceptable message length
+ * @param msg Receives the start of the protobuf message
+ * @param len Receives the message length
+ *
+ * @return heka_frame
+ */
+heka_frame parse_heka_frame(const char *p, const char *e, size_t max_message_size,
+                            const char **msg, size_t *len);
+
+}
+}
+}
+#endif
@@ -7,6 +7,7 @@
 /// @brief Hindsight Administration Interface @file
 
 #include <stdexcept>
+#include <thread>
 
 #include <Wt/Auth/AuthWidget>
 #include <Wt/WAnchor>
@@ -19,13 +20,21 @@
 #include <Wt/WString>
 #include <Wt/WTabWidget>
 #include <Wt/WText>
+#include <boost/lexical_cast.hpp>
 
 #include "auth_widget.h"
 #include "constants.h"
+#include "file_watcher.h"
 #include "hindsight_admin.h"
+#include "matcher_cache.h"
+#include "message_cache.h"
 #include "output_tester.h"
 #include "plugins.h"
+#include "queue_index.h"
+#include "scan_jobs.h"
+#include "scan_pool.h"
 #include "session.h"
+#include "stats_collector.h"
 #include "tester.h"
 #include "utilization.h"
 
@@ -45,6 +54,14 @@ namespace hs = mozilla::services::hindsight;
 namespace fs = boost::filesystem;
 
 static hs::hindsight_cfg g_cfg;
+static hs::file_watcher g_watcher;
+static hs::stats_collector g_stats;
+static hs::scan_pool g_scan_pool;
+static hs::queue_index g_queue_index;
+static hs::scan_jobs g_scan_jobs;
+static hs::matcher_cache g_matcher_cache;
+static hs::message_cache g_message_cache;
+static hs::services g_services;
 
 
 static string get_version()
@@ -199,7 +216,7 @@ void hs::hindsight_cfg::load_cfg(const string &fn)
 
 static Wt::WApplication* create_application(const Wt::WEnvironment &env)
 {
-  return new hs::hindsight_admin(env, &g_cfg);
+  return new hs::hindsight_admin(env, &g_services);
 }
 
 
@@ -210,9 +227,40 @@ int main(int argc, char **argv)
     string hs_cfg;
     server.readConfigurationProperty("hs_cfg", hs_cfg);
     g_cfg.load_cfg(hs_cfg);
+    g_watcher.start();
+    g_stats.start(&g_cfg, &g_watcher, fs::path(server.appRoot()) / "stats");
+    unsigned threads = thread::hardware_concurrency();
+    string val;
+    if (server.readConfigurationProperty("matcher_threads", val)) {
+      threads = boost::lexical_cast<unsigned>(val);
+    }
+    g_scan_pool.start(threads > 1 ? threads - 1 : 0); // the request thread joins in
+    g_queue_index.start(&g_cfg, &g_watcher, fs::path(server.appRoot()) / "queue_index");
+    unsigned jobs = 2;
+    if (server.readConfigurationProperty("matcher_jobs_per_session", val)) {
+      jobs = boost::lexical_cast<unsigned>(val);
+    }
+    g_scan_jobs.start(jobs);
+    size_t matchers = 256;
+    if (server.readConfigurationProperty("matcher_cache_size", val)) {
+      matchers = boost::lexical_cast<size_t>(val);
+    }
+    g_matcher_cache.start(matchers);
+    size_t recent_mb = 64;
+    if (server.readConfigurationProperty("matcher_message_cache_mb", val)) {
+      recent_mb = boost::lexical_cast<size_t>(val);
+    }
+    g_message_cache.start(recent_mb * 1024 * 1024);
+    g_services = { &g_cfg, &g_stats, &g_watcher, &g_scan_pool, &g_queue_index, &g_scan_jobs,
+                   &g_matcher_cache, &g_message_cache };
     server.addEntryPoint(Wt::Application, create_application);
     hs::session::configure_auth();
     server.run();
+    g_scan_jobs.stop();
+    g_queue_index.stop();
+    g_scan_pool.stop();
+    g_stats.stop();
+    g_watcher.stop();
   } catch (Wt::WServer::Exception &e) {
     std::cerr << e.what() << std::endl;
   } catch (std::exception &e) {
@@ -223,11 +271,13 @@ int main(int argc, char **argv)
 }
 
 
-hs::hindsight_admin::hindsight_admin(const Wt::WEnvironment &env, const hindsight_cfg *cfg) :
+hs::hindsight_admin::hindsight_admin(const Wt::WEnvironment &env, const services *svc) :
     Wt::WApplication(env),
-    m_hs_cfg(cfg)
+    m_services(svc),
+    m_hs_cfg(svc->cfg)
 {
   messageResourceBundle().use(WApplication::docRoot() + "/resource_bundle/hindsight_admin");
+  enableUpdates(true);
   useStyleSheet("/css/hindsight_admin.css");
   setCssTheme("polished");
   //setTheme(new Wt::WBootstrapTheme());
@@ -271,22 +321,22 @@ void hs::hindsight_admin::renderSite()
 {
   m_tw = new Wt::WTabWidget(m_admin);
 
-  hs::utilization *utilization = new hs::utilization(&m_session, m_hs_cfg);
+  hs::utilization *utilization = new hs::utilization(&m_session, m_hs_cfg, m_services->stats);
   m_tw->addTab(utilization, tr("tab_utilization"));
 
-  hs::plugins *plugins = new hs::plugins(&m_session, m_hs_cfg);
+  hs::plugins *plugins = new hs::plugins(&m_session, m_hs_cfg, m_services->stats);
   m_tw->addTab(plugins, tr("tab_plugins"));
 
-  m_tw->addTab(new hs::matcher(m_hs_cfg), tr("tab_matcher"));
+  m_tw->addTab(new hs::matcher(m_services), tr("tab_matcher"));
 
   if (!m_hs_cfg->m_hs_load.empty()) {
-    m_tw->addTab(new hs::tester(&m_session, m_hs_cfg, plugins), tr("tab_deploy"));
+    m_tw->addTab(new hs::tester(&m_session, m_services, plugins), tr("tab_deploy"));
   }
 
   std::string val;
   if (!m_hs_cfg->m_hs_load.empty() &&
       Wt::WApplication::instance()->readConfigurationProperty("outputPlugins", val)) {
-    m_tw->addTab(new hs::output_tester(&m_session, m_hs_cfg, plugins), tr("tab_output_deploy"));
+    m_tw->addTab(new hs::output_tester(&m_session, m_services, plugins), tr("tab_output_deploy"));
   }
 
   Wt::WContainerWidget *dash = new Wt::WContainerWidget();
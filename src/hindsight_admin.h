@@ -17,7 +17,14 @@
 #include <Wt/WString>
 #include <Wt/WTabWidget>
 
+#include "file_watcher.h"
+#include "matcher_cache.h"
+#include "message_cache.h"
+#include "queue_index.h"
+#include "scan_jobs.h"
+#include "scan_pool.h"
 #include "session.h"
+#include "stats_collector.h"
 
 namespace mozilla {
 namespace services {
@@ -48,12 +55,29 @@ struct hindsight_cfg {
 };
 
 
+/**
+ * The server wide objects main() starts and every session shares; they
+ * outlive all the sessions.
+ */
+struct services {
+  const hindsight_cfg *cfg;
+  stats_collector     *stats;
+  file_watcher        *watcher;
+  scan_pool           *pool;
+  const queue_index   *index;
+  scan_jobs           *jobs;
+  matcher_cache       *matchers;
+  message_cache       *recent;
+};
+
+
 class hindsight_admin : public Wt::WApplication {
 public:
-  hindsight_admin(const Wt::WEnvironment &env, const hindsight_cfg *cfg);
+  hindsight_admin(const Wt::WEnvironment &env, const services *svc);
 
 private:
   mozilla::services::hindsight::session m_session;
+  const services                        *m_services;
   const hindsight_cfg                   *m_hs_cfg;
   Wt::WContainerWidget                  *m_admin;
   Wt::WTabWidget                        *m_tw;
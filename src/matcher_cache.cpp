@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Compiled Message Matcher Cache Implementation @file
+
+#include "matcher_cache.h"
+
+#include <cctype>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+
+hs::matcher_cache::matcher_cache() :
+    m_capacity(256),
+    m_hits(0),
+    m_misses(0) { }
+
+
+void hs::matcher_cache::start(size_t capacity)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_capacity = capacity ? capacity : 1;
+  while (m_lru.size() > m_capacity) {
+    m_entries.erase(m_lru.back().first);
+    m_lru.pop_back();
+  }
+}
+
+
+hs::compiled_matcher hs::matcher_cache::get(const std::string &mms)
+{
+  string key = normalize(mms);
+  {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      ++m_hits;
+      return it->second->second;
+    }
+  }
+  ++m_misses;
+
+  // compiled outside of the lock, the expression can be long
+  compiled_matcher mm(lsb_create_message_matcher(key.c_str()),
+                      lsb_destroy_message_matcher);
+  if (!mm.get()) {
+    return compiled_matcher();
+  }
+
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it != m_entries.end()) { // compiled concurrently, keep the first one
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return it->second->second;
+  }
+  m_lru.push_front(make_pair(key, mm));
+  m_entries[key] = m_lru.begin();
+  if (m_lru.size() > m_capacity) {
+    m_entries.erase(m_lru.back().first);
+    m_lru.pop_back();
+  }
+  return mm;
+}
+
+
+size_t hs::matcher_cache::size() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_lru.size();
+}
+
+
+std::string hs::matcher_cache::normalize(const std::string &mms)
+{
+  string n;
+  n.reserve(mms.size());
+  char literal = 0; // closing delimiter of the literal being copied
+  bool space = false;
+  for (size_t i = 0; i < mms.size(); ++i) {
+    char c = mms[i];
+    if (literal) {
+      n.push_back(c);
+      if (c == '\\' && i + 1 < mms.size()) {
+        n.push_back(mms[++i]);
+      } else if (c == literal) {
+        literal = 0;
+      }
+      continue;
+    }
+    if (isspace(static_cast<unsigned char>(c))) {
+      space = true;
+      continue;
+    }
+    if (space && !n.empty()) n.push_back(' ');
+    space = false;
+    if (c == '\'' || c == '"' || c == '/') literal = c;
+    n.push_back(c);
+  }
+  return n;
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Compiled Message Matcher Cache @file
+
+#ifndef hindsight_admin_matcher_cache_h_
+#define hindsight_admin_matcher_cache_h_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <luasandbox/util/heka_message_matcher.h>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * A compiled matcher only holds the parsed expression tree; evaluating it
+ * does not modify it so one instance can be shared by all the scan threads.
+ */
+typedef std::shared_ptr<lsb_message_matcher> compiled_matcher;
+
+
+/**
+ * Server wide LRU cache of compiled message matchers keyed by the normalized
+ * expression so validating a plugin configuration and repeating a scan do not
+ * parse the same expression again. Evicted matchers stay alive for as long as
+ * a scan still holds them.
+ */
+class matcher_cache {
+public:
+  matcher_cache();
+
+  void start(size_t capacity);
+
+  /**
+   * @return compiled_matcher Empty if the expression is invalid (invalid
+   *                          expressions are not cached)
+   */
+  compiled_matcher get(const std::string &mms);
+
+  uint64_t hits() const { return m_hits; }
+  uint64_t misses() const { return m_misses; }
+  size_t size() const;
+
+  /**
+   * Trims the expression and collapses the whitespace outside of the string
+   * and regex literals.
+   */
+  static std::string normalize(const std::string &mms);
+
+private:
+  typedef std::list<std::pair<std::string, compiled_matcher> > lru;
+
+  size_t                                        m_capacity;
+  lru                                           m_lru; // most recent first
+  std::unordered_map<std::string, lru::iterator> m_entries;
+  std::atomic<uint64_t>                         m_hits;
+  std::atomic<uint64_t>                         m_misses;
+  mutable std::mutex                            m_mutex;
+};
+
+}
+}
+}
+#endif
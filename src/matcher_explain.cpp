@@ -0,0 +1,179 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Message Matcher Explain Implementation @file
+
+#include "matcher_explain.h"
+
+#include <chrono>
+
+#include <luasandbox/util/heka_message.h>
+
+#include "matcher_cache.h"
+#include "run_matcher.h"
+#include "scan_jobs.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+static const chrono::milliseconds g_min_timing(20); // per expression
+static const int g_max_passes = 100;
+
+
+/**
+ * Walks the expression outside of the string and regex literals.
+ *
+ * @param visit Called with the offset and parenthesis depth of each character
+ *              (the depth before an opening and after a closing parenthesis)
+ */
+template<class F>
+static void
+walk(const string &s, F visit)
+{
+  char literal = 0;
+  int depth = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    char c = s[i];
+    if (literal) {
+      if (c == '\\') {
+        ++i;
+      } else if (c == literal) {
+        literal = 0;
+      }
+      continue;
+    }
+    switch (c) {
+    case '\'':
+    case '"':
+    case '/':
+      literal = c;
+      break;
+    case '(':
+      visit(i, depth++);
+      continue;
+    case ')':
+      visit(i, --depth);
+      continue;
+    }
+    visit(i, depth);
+  }
+}
+
+
+static bool
+enclosed(const string &s)
+{
+  if (s.size() < 2 || s[0] != '(' || s[s.size() - 1] != ')') return false;
+  size_t close = string::npos;
+  walk(s, [&](size_t i, int depth) {
+    if (close == string::npos && depth == 0 && s[i] == ')') close = i;
+  });
+  return close == s.size() - 1;
+}
+
+
+static string
+trim(const string &s)
+{
+  size_t b = s.find_first_not_of(' ');
+  if (b == string::npos) return string();
+  size_t e = s.find_last_not_of(' ');
+  return s.substr(b, e - b + 1);
+}
+
+
+vector<string> hs::split_terms(const std::string &mms, std::string *op)
+{
+  string s = trim(matcher_cache::normalize(mms));
+  while (enclosed(s)) {
+    s = trim(s.substr(1, s.size() - 2));
+  }
+
+  vector<size_t> ands, ors;
+  walk(s, [&](size_t i, int depth) {
+    if (depth != 0 || i + 1 >= s.size() || s[i + 1] != s[i]) return;
+    if (s[i] == '&' && (ands.empty() || ands.back() + 1 < i)) ands.push_back(i);
+    if (s[i] == '|' && (ors.empty() || ors.back() + 1 < i)) ors.push_back(i);
+  });
+  const vector<size_t> &at = ors.empty() ? ands : ors;
+  op->clear();
+  if (at.empty()) {
+    return vector<string>(1, s);
+  }
+  *op = ors.empty() ? "&&" : "||";
+
+  vector<string> terms;
+  size_t begin = 0;
+  for (auto it = at.begin(); it != at.end(); ++it) {
+    terms.push_back(trim(s.substr(begin, *it - begin)));
+    begin = *it + 2;
+  }
+  terms.push_back(trim(s.substr(begin)));
+  return terms;
+}
+
+
+static void
+time_term(hs::matcher_cache *matchers, vector<lsb_heka_message> &msgs,
+          hs::scan_progress *progress, hs::matcher_explain::term *t)
+{
+  hs::compiled_matcher mm = matchers->get(t->expression);
+  t->valid = mm.get() != nullptr;
+  if (!t->valid || msgs.empty()) return;
+
+  auto started = chrono::steady_clock::now();
+  auto elapsed = chrono::steady_clock::duration::zero();
+  int passes = 0;
+  uint64_t matches = 0;
+  while (passes < g_max_passes && (passes == 0 || elapsed < g_min_timing)
+         && !progress->cancel) {
+    matches = 0;
+    for (auto it = msgs.begin(); it != msgs.end(); ++it) {
+      if (lsb_eval_message_matcher(mm.get(), &*it)) ++matches;
+    }
+    ++passes;
+    elapsed = chrono::steady_clock::now() - started;
+  }
+  t->matches = matches;
+  t->ns = chrono::duration<double, nano>(elapsed).count() / passes / msgs.size();
+}
+
+
+void hs::explain_matcher(matcher_cache *matchers, const std::string &mms,
+                         scan_progress *progress, matcher_explain *r)
+{
+  vector<lsb_heka_message> msgs;
+  if (r->corpus) {
+    const vector<string> &raw = r->corpus->messages;
+    msgs.reserve(raw.size());
+    lsb_heka_message m;
+    lsb_init_heka_message(&m, 10);
+    for (auto it = raw.begin(); it != raw.end(); ++it) {
+      if (lsb_decode_heka_message(&m, it->data(), it->size(), NULL)) {
+        msgs.push_back(m); // the decoded fields point into the corpus
+        lsb_init_heka_message(&m, 10);
+      }
+    }
+    lsb_free_heka_message(&m);
+  }
+  r->messages = msgs.size();
+
+  r->total.expression = mms;
+  time_term(matchers, msgs, progress, &r->total);
+  vector<string> terms = split_terms(mms, &r->op);
+  if (terms.size() > 1) {
+    for (auto it = terms.begin(); it != terms.end() && !progress->cancel; ++it) {
+      r->terms.push_back(matcher_explain::term());
+      r->terms.back().expression = *it;
+      time_term(matchers, msgs, progress, &r->terms.back());
+    }
+  }
+  r->cancelled = progress->cancel;
+
+  for (auto it = msgs.begin(); it != msgs.end(); ++it) {
+    lsb_free_heka_message(&*it);
+  }
+}
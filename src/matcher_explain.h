@@ -0,0 +1,69 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Message Matcher Explain @file
+
+#ifndef hindsight_admin_matcher_explain_h_
+#define hindsight_admin_matcher_explain_h_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+class matcher_cache;
+struct scan_progress;
+struct scan_result;
+
+/**
+ * Cost and selectivity of a message matcher and of its top level terms over
+ * a corpus of queue messages.
+ */
+struct matcher_explain {
+  struct term {
+    term() : valid(false), matches(0), ns(0) { }
+
+    std::string expression;
+    bool        valid;    // compiled on its own
+    uint64_t    matches;
+    double      ns;       // per message
+  };
+
+  matcher_explain() : messages(0), cancelled(false) { }
+
+  std::shared_ptr<const scan_result>  corpus;
+  size_t                              messages; // decoded corpus messages
+  std::string                         op;       // "&&", "||" or empty
+  term                                total;
+  std::vector<term>                   terms;
+  bool                                cancelled;
+};
+
+
+/**
+ * Splits an expression into its top level terms: on || if it has any at the
+ * top level (&& binds tighter), otherwise on &&. Enclosing parentheses are
+ * removed first.
+ *
+ * @param op Receives the operator ("&&", "||" or empty for a single term)
+ */
+std::vector<std::string> split_terms(const std::string &mms, std::string *op);
+
+/**
+ * Evaluates the matcher and each of its terms over r->corpus, repeating the
+ * passes until the timing is stable. Runs off the session thread.
+ */
+void explain_matcher(matcher_cache *matchers, const std::string &mms,
+                     scan_progress *progress, matcher_explain *r);
+
+}
+}
+}
+#endif
@@ -0,0 +1,286 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Message Browser Implementation @file
+
+#include "message_browser.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+#include <Wt/WTree>
+#include <luasandbox/util/heka_message.h>
+#include <luasandbox/util/protobuf.h>
+
+#include "hindsight_admin.h"
+#include "run_matcher.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+static const char*
+read_string(int wiretype, const char *p, const char *e, lsb_const_string *s)
+{
+  if (wiretype != LSB_PB_WT_LENGTH) {
+    return NULL;
+  }
+
+  long long vi;
+  p = lsb_pb_read_varint(p, e, &vi);
+  if (!p || vi < 0 || p + vi > e) {
+    return NULL;
+  }
+  s->s = p;
+  s->len = (size_t)vi;
+  return p + vi;
+}
+
+
+static void
+output_string_values(const char *p, const char *e, stringstream &ss)
+{
+  int acnt = 0;
+  int tag = 0;
+  int wiretype = 0;
+  lsb_const_string s;
+  while (p && p < e) {
+    p = lsb_pb_read_key(p, &tag, &wiretype);
+    p = read_string(wiretype, p, e, &s);
+    if (p) {
+      if (acnt++) ss << ", ";
+      ss << "\"" << std::string(s.s, s.len) << "\"";
+    }
+  }
+}
+
+
+static void
+output_integer_values(const char *p, const char *e, stringstream &ss)
+{
+  int acnt = 0;
+  long long ll = 0;
+  while (p && p < e) {
+    p = lsb_pb_read_varint(p, e, &ll);
+    if (p) {
+      if (acnt++) ss << ", ";
+      ss << ll;
+    }
+  }
+}
+
+static void
+output_double_values(const char *p, const char *e, stringstream &ss)
+{
+  int acnt = 0;
+  double d = 0;
+  while (p && p < e) {
+    memcpy(&d, p, sizeof(double));
+    if (acnt++) ss << ", ";
+    ss << d;
+    p += sizeof(double);
+  }
+}
+
+
+static void
+output_fields(lsb_heka_message *m, Wt::WTreeNode *n)
+{
+  const char *p, *e;
+  for (int i = 0; i < m->fields_len; ++i) {
+    stringstream ss;
+    lsb_heka_field *hf = &m->fields[i];
+    ss << std::string(hf->name.s, hf->name.len) << " = ";
+    p = hf->value.s;
+    e = p + hf->value.len;
+    switch (hf->value_type) {
+    case LSB_PB_STRING:
+    case LSB_PB_BYTES:
+      output_string_values(p, e, ss);
+      break;
+    case LSB_PB_INTEGER:
+    case LSB_PB_BOOL:
+      output_integer_values(p, e, ss);
+      break;
+    case LSB_PB_DOUBLE:
+      output_double_values(p, e, ss);
+      break;
+    }
+    n->addChildNode(new Wt::WTreeNode(Wt::WString(ss.str(), Wt::CharEncoding::UTF8)));
+  }
+}
+
+
+static string
+message_label(const string &raw)
+{
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  stringstream ss;
+  ss << "Uuid = ";
+  if (lsb_decode_heka_message(&m, raw.data(), raw.size(), NULL)) {
+    for (unsigned i = 0; i < LSB_UUID_SIZE; ++i) {
+      ss << std::setfill('0') << std::setw(2) << std::hex << (unsigned int)((unsigned char)m.uuid.s[i]);
+    }
+  }
+  lsb_free_heka_message(&m);
+  return ss.str();
+}
+
+
+hs::message_node::message_node(const string &raw, const char *queue) :
+    Wt::WTreeNode(message_label(raw)),
+    m_raw(raw),
+    m_queue(queue)
+{
+  setLoadPolicy(Wt::WTreeNode::LazyLoading);
+}
+
+
+void hs::message_node::populate()
+{
+  lsb_heka_message msg;
+  lsb_init_heka_message(&msg, 10);
+  if (!lsb_decode_heka_message(&msg, m_raw.data(), m_raw.size(), NULL)) {
+    lsb_free_heka_message(&msg);
+    return;
+  }
+  lsb_heka_message *m = &msg;
+
+  stringstream ss;
+  if (m_queue) {
+    ss << "Queue = " << m_queue;
+    addChildNode(new Wt::WTreeNode(ss.str()));
+    ss.str("");
+  }
+
+  char ts[80];
+  time_t t = m->timestamp / 1000000000;
+  struct tm *tms = gmtime(&t);
+  strftime(ts, sizeof ts, "%F %X", tms);
+  ss << "Timestamp = " << ts;
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "Type = " << std::string(m->type.s, m->type.len);
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "Logger = " << std::string(m->logger.s, m->logger.len);
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "Severity = " << std::dec << m->severity;
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "Payload = " << std::string(m->payload.s, m->payload.len);
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "EnvVersion = " << std::string(m->env_version.s, m->env_version.len);
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "Pid = ";
+  if (m->pid != INT_MIN) {
+    ss << std::dec << m->pid;
+  }
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  ss.str("");
+  ss << "Hostname = " << std::string(m->hostname.s, m->hostname.len);
+  addChildNode(new Wt::WTreeNode(ss.str()));
+
+  if (m->fields_len) {
+    Wt::WTreeNode *f = new Wt::WTreeNode(hs::tr("fields"));
+    f->setLoadPolicy(Wt::WTreeNode::NextLevelLoading);
+    output_fields(m, f);
+    addChildNode(f);
+  }
+  lsb_free_heka_message(&msg);
+}
+
+
+const size_t hs::message_browser::page_size;
+
+
+hs::message_browser::message_browser(Wt::WContainerWidget *parent) :
+    Wt::WContainerWidget(parent),
+    m_page(0)
+{
+  m_tree = new Wt::WContainerWidget(this);
+
+  m_pager = new Wt::WContainerWidget(this);
+  m_pager->setStyleClass("message_pager");
+  m_previous = new Wt::WPushButton(tr("page_previous"), m_pager);
+  m_previous->clicked().connect(this, &message_browser::previous_page);
+  m_position = new Wt::WText(m_pager);
+  m_next = new Wt::WPushButton(tr("page_next"), m_pager);
+  m_next->clicked().connect(this, &message_browser::next_page);
+  m_pager->hide();
+}
+
+
+void hs::message_browser::set_messages(const shared_ptr<const scan_result> &r)
+{
+  m_result = r;
+  show_page(0);
+}
+
+
+void hs::message_browser::show_page(size_t page)
+{
+  m_tree->clear();
+  m_page = page;
+  size_t total = m_result ? m_result->messages.size() : 0;
+  if (total == 0) {
+    m_pager->hide();
+    return;
+  }
+
+  Wt::WTree *tree = new Wt::WTree(m_tree);
+  tree->setSelectionMode(Wt::SingleSelection);
+  Wt::WTreeNode *root = new Wt::WTreeNode(tr("messages"));
+  root->setStyleClass("tree_results");
+  tree->setTreeRoot(root);
+  root->label()->setTextFormat(Wt::PlainText);
+
+  const vector<unsigned> &queues = m_result->queues;
+  bool merged = adjacent_find(queues.begin(), queues.end(),
+                              not_equal_to<unsigned>()) != queues.end();
+  size_t first = page * page_size;
+  size_t last = min(first + page_size, total);
+  for (size_t i = first; i < last; ++i) {
+    const char *queue = merged && i < queues.size()
+        ? scan_options::queue_name(queues[i]) : NULL;
+    root->addChildNode(new message_node(m_result->messages[i], queue));
+  }
+  root->expand();
+
+  m_previous->setEnabled(first > 0);
+  m_next->setEnabled(last < total);
+  m_position->setText(Wt::WString::tr("page_position")
+                      .arg(static_cast<int>(first + 1))
+                      .arg(static_cast<int>(last))
+                      .arg(static_cast<int>(total)));
+  m_pager->setHidden(total <= page_size);
+}
+
+
+void hs::message_browser::previous_page()
+{
+  if (m_page > 0) show_page(m_page - 1);
+}
+
+
+void hs::message_browser::next_page()
+{
+  if ((m_page + 1) * page_size < m_result->messages.size()) show_page(m_page + 1);
+}
@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Message Browser @file
+
+#ifndef hindsight_admin_message_browser_h_
+#define hindsight_admin_message_browser_h_
+
+#include <memory>
+#include <string>
+
+#include <Wt/WContainerWidget>
+#include <Wt/WPushButton>
+#include <Wt/WText>
+#include <Wt/WTreeNode>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+struct scan_result;
+
+/**
+ * Tree node of one Heka message. Only the raw protobuf is kept; the message
+ * is decoded and its headers/fields are turned into child nodes when the node
+ * is expanded for the first time.
+ */
+class message_node : public Wt::WTreeNode {
+public:
+  /**
+   * @param raw Heka protobuf message
+   * @param queue Queue label shown with the headers (NULL for none)
+   */
+  message_node(const std::string &raw, const char *queue = NULL);
+
+protected:
+  void populate();
+  bool expandable() { return true; }
+
+private:
+  std::string m_raw;
+  const char  *m_queue;
+};
+
+
+/**
+ * Pages through the messages of a scan result; only the current page is
+ * turned into (collapsed) tree nodes so the browser and server cost does not
+ * grow with the sample size.
+ */
+class message_browser : public Wt::WContainerWidget {
+public:
+  static const size_t page_size = 50;
+
+  message_browser(Wt::WContainerWidget *parent = 0);
+
+  void set_messages(const std::shared_ptr<const scan_result> &r);
+
+private:
+  void show_page(size_t page);
+  void previous_page();
+  void next_page();
+
+  std::shared_ptr<const scan_result>  m_result;
+  size_t                              m_page;
+  // pointers managed by the container
+  Wt::WContainerWidget                *m_tree;
+  Wt::WContainerWidget                *m_pager;
+  Wt::WPushButton                     *m_previous;
+  Wt::WText                           *m_position;
+  Wt::WPushButton                     *m_next;
+  // end managed pointers
+};
+
+}
+}
+}
+#endif
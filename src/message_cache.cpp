@@ -0,0 +1,173 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Decoded Message Cache Implementation @file
+
+#include "message_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "heka_scanner.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const size_t g_check_bytes = 64; // compared to detect a replaced file
+
+
+hs::message_block::message_block() :
+    begin(0),
+    end(0),
+    bytes(0) { }
+
+
+hs::message_block::~message_block()
+{
+  for (auto it = messages.begin(); it != messages.end(); ++it) {
+    lsb_free_heka_message(&*it);
+  }
+}
+
+
+/**
+ * @return bool True if the bytes the block holds are still those of the file
+ */
+static bool
+same_file(const hs::message_block &b, const hs::heka_scanner &file)
+{
+  if (b.end > file.size()) return false;
+  size_t len = min(g_check_bytes, b.end - b.begin);
+  return memcmp(b.arena.get() + (b.end - b.begin - len), file.data() + b.end - len, len) == 0;
+}
+
+
+/**
+ * Decodes the newest messages of the file that fit in capacity, the decoded
+ * views count as well as the frames.
+ */
+static shared_ptr<hs::message_block>
+decode_block(const hs::heka_scanner &file, size_t end, size_t capacity,
+             size_t max_message_size)
+{
+  size_t begin = end > capacity ? file.find_frame(end - capacity) : 0;
+  if (begin >= end) return nullptr;
+
+  // sized on the mapping first, the message overhead can exceed the frames
+  hs::heka_scanner scanner;
+  scanner.open(file.data() + begin, end - begin, max_message_size);
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  vector<pair<size_t, size_t> > costs; // offset, bytes
+  while (scanner.next(&m)) {
+    costs.push_back(make_pair(begin + scanner.offset(), scanner.position() - scanner.offset()
+                              + sizeof(m) + sizeof(lsb_heka_field) * m.fields_size));
+  }
+  size_t bytes = 0;
+  size_t first = costs.size();
+  while (first > 0 && bytes + costs[first - 1].second <= capacity) {
+    bytes += costs[--first].second;
+  }
+  if (first == costs.size()) {
+    lsb_free_heka_message(&m);
+    return nullptr;
+  }
+  begin = costs[first].first;
+
+  auto b = make_shared<hs::message_block>();
+  b->begin = begin;
+  b->end = end;
+  b->arena.reset(new char[end - begin]);
+  memcpy(b->arena.get(), file.data() + begin, end - begin);
+  b->bytes = end - begin;
+  b->messages.reserve(costs.size() - first);
+  b->offsets.reserve(costs.size() - first);
+  scanner.open(b->arena.get(), end - begin, max_message_size);
+  while (scanner.next(&m)) {
+    b->bytes += sizeof(m) + sizeof(lsb_heka_field) * m.fields_size;
+    b->messages.push_back(m); // the decoded fields point into the arena
+    b->offsets.push_back(begin + scanner.offset());
+    lsb_init_heka_message(&m, 10);
+  }
+  lsb_free_heka_message(&m);
+  return b;
+}
+
+
+hs::message_cache::message_cache() :
+    m_max_bytes(0),
+    m_bytes(0),
+    m_hits(0),
+    m_misses(0) { }
+
+
+void hs::message_cache::start(size_t max_bytes)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_max_bytes = max_bytes;
+  while (m_bytes > m_max_bytes) {
+    m_bytes -= m_lru.back().second->bytes;
+    m_entries.erase(m_lru.back().first);
+    m_lru.pop_back();
+  }
+}
+
+
+shared_ptr<const hs::message_block>
+hs::message_cache::head(const fs::path &fn, const heka_scanner &file, size_t end,
+                        size_t max_message_size)
+{
+  string key = fn.string();
+  size_t capacity;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    capacity = m_max_bytes / 2;
+    if (capacity == 0) return nullptr;
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      const message_block &b = *it->second->second;
+      if ((end <= b.end || end - b.end <= capacity / 4) && same_file(b, file)) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        ++m_hits;
+        return it->second->second;
+      }
+    }
+  }
+  ++m_misses;
+
+  // decoded outside of the lock, a block is large
+  shared_ptr<const message_block> b = decode_block(file, end, capacity, max_message_size);
+  if (!b) return nullptr;
+
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it != m_entries.end()) { // replaced, or decoded concurrently
+    if (it->second->second->end >= b->end && same_file(*it->second->second, file)) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      return it->second->second;
+    }
+    m_bytes -= it->second->second->bytes;
+    m_lru.erase(it->second);
+    m_entries.erase(it);
+  }
+  m_lru.push_front(make_pair(key, b));
+  m_entries[key] = m_lru.begin();
+  m_bytes += b->bytes;
+  while (m_bytes > m_max_bytes && m_lru.size() > 1) {
+    m_bytes -= m_lru.back().second->bytes;
+    m_entries.erase(m_lru.back().first);
+    m_lru.pop_back();
+  }
+  return b;
+}
+
+
+size_t hs::message_cache::bytes() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_bytes;
+}
@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Decoded Message Cache @file
+
+#ifndef hindsight_admin_message_cache_h_
+#define hindsight_admin_message_cache_h_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <luasandbox/util/heka_message.h>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+class heka_scanner;
+
+/**
+ * The newest bytes of a queue file decoded once: the frames are copied into
+ * one contiguous arena and the messages are read only views into it, shared
+ * by every scan holding the block.
+ */
+struct message_block {
+  message_block();
+  ~message_block();
+
+  message_block(const message_block &) = delete;
+  message_block& operator=(const message_block &) = delete;
+
+  size_t                        begin;    // byte range of the queue file
+  size_t                        end;
+  std::unique_ptr<char[]>       arena;
+  std::vector<lsb_heka_message> messages; // oldest first
+  std::vector<size_t>           offsets;  // of each message in the queue file
+  size_t                        bytes;    // held by the arena and the messages
+};
+
+
+/**
+ * Server wide cache of the head (newest file) of each queue so repeated and
+ * concurrent matcher and tester runs evaluate the recent traffic from memory
+ * instead of decoding it again. The total size is bounded, the least
+ * recently used blocks are evicted first and stay alive for as long as a scan
+ * still holds them.
+ */
+class message_cache {
+public:
+  message_cache();
+
+  /**
+   * @param max_bytes Zero disables the cache; one block holds at most half
+   *                  of it so the head of both queues fits
+   */
+  void start(size_t max_bytes);
+
+  /**
+   * Returns the cached head of a queue file, decoding it again from the
+   * mapped file when it is missing, was replaced or has fallen more than a
+   * quarter of a block behind end (a block behind end still serves the bytes
+   * it covers).
+   *
+   * @param fn Path of the queue file
+   * @param file Mapping of the queue file
+   * @param end Checkpointed end of the file
+   *
+   * @return std::shared_ptr<const message_block> Empty if the cache is
+   *         disabled or there is no message
+   */
+  std::shared_ptr<const message_block>
+  head(const boost::filesystem::path &fn, const heka_scanner &file, size_t end,
+       size_t max_message_size);
+
+  uint64_t hits() const { return m_hits; }
+  uint64_t misses() const { return m_misses; }
+  size_t bytes() const;
+
+private:
+  typedef std::list<std::pair<std::string, std::shared_ptr<const message_block> > > lru;
+
+  size_t                                          m_max_bytes;
+  size_t                                          m_bytes;
+  lru                                             m_lru; // most recent first
+  std::unordered_map<std::string, lru::iterator>  m_entries;
+  std::atomic<uint64_t>                           m_hits;
+  std::atomic<uint64_t>                           m_misses;
+  mutable std::mutex                              m_mutex;
+};
+
+}
+}
+}
+#endif
@@ -0,0 +1,298 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Matched Message Export Implementation @file
+
+#include "message_export.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <Wt/Http/Request>
+#include <Wt/Http/Response>
+#include <boost/any.hpp>
+#include <luasandbox/util/heka_message.h>
+#include <luasandbox/util/protobuf.h>
+
+#include "heka_scanner.h"
+#include "run_matcher.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const size_t g_chunk_bytes = 256 * 1024;       // written per request
+static const size_t g_scan_bytes = 16 * 1024 * 1024;  // scanned per request
+
+namespace {
+
+struct export_state {
+  export_state() : file(0), offset(0) { }
+
+  shared_ptr<const hs::message_export::settings>  settings;
+  vector<pair<fs::path, size_t> >                 files; // path, checkpointed end
+  size_t                                          file;
+  size_t                                          offset;
+};
+
+}
+
+
+static void
+write_json_string(ostream &os, const char *s, size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+  os << '"';
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = static_cast<unsigned char>(s[i]);
+    switch (c) {
+    case '"':  os << "\\\""; break;
+    case '\\': os << "\\\\"; break;
+    case '\n': os << "\\n"; break;
+    case '\r': os << "\\r"; break;
+    case '\t': os << "\\t"; break;
+    default:
+      if (c < 0x20) {
+        os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+      } else {
+        os << s[i];
+      }
+    }
+  }
+  os << '"';
+}
+
+
+static void
+write_base64(ostream &os, const char *s, size_t len)
+{
+  static const char b64[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  os << '"';
+  for (size_t i = 0; i < len; i += 3) {
+    unsigned v = static_cast<unsigned char>(s[i]) << 16;
+    if (i + 1 < len) v |= static_cast<unsigned char>(s[i + 1]) << 8;
+    if (i + 2 < len) v |= static_cast<unsigned char>(s[i + 2]);
+    os << b64[(v >> 18) & 0x3f] << b64[(v >> 12) & 0x3f]
+        << (i + 1 < len ? b64[(v >> 6) & 0x3f] : '=')
+        << (i + 2 < len ? b64[v & 0x3f] : '=');
+  }
+  os << '"';
+}
+
+
+static void
+write_double(ostream &os, double d)
+{
+  if (std::isfinite(d)) {
+    os << setprecision(numeric_limits<double>::max_digits10) << d;
+  } else {
+    os << "null";
+  }
+}
+
+
+/**
+ * Writes the (repeated) value of a field, as an array if there is more than
+ * one.
+ */
+static void
+write_field_value(ostream &os, const lsb_heka_field &hf)
+{
+  const char *p = hf.value.s;
+  const char *e = p + hf.value.len;
+  int cnt = 0;
+  stringstream values;
+  switch (hf.value_type) {
+  case LSB_PB_STRING:
+  case LSB_PB_BYTES:
+    while (p && p < e) {
+      int tag = 0;
+      int wiretype = 0;
+      long long len = 0;
+      p = lsb_pb_read_key(p, &tag, &wiretype);
+      if (!p || wiretype != LSB_PB_WT_LENGTH) break;
+      p = lsb_pb_read_varint(p, e, &len);
+      if (!p || len < 0 || p + len > e) break;
+      if (cnt++) values << ',';
+      if (hf.value_type == LSB_PB_BYTES) {
+        write_base64(values, p, static_cast<size_t>(len));
+      } else {
+        write_json_string(values, p, static_cast<size_t>(len));
+      }
+      p += len;
+    }
+    break;
+  case LSB_PB_INTEGER:
+  case LSB_PB_BOOL:
+    while (p && p < e) {
+      long long ll = 0;
+      p = lsb_pb_read_varint(p, e, &ll);
+      if (!p) break;
+      if (cnt++) values << ',';
+      if (hf.value_type == LSB_PB_BOOL) {
+        values << (ll ? "true" : "false");
+      } else {
+        values << ll;
+      }
+    }
+    break;
+  case LSB_PB_DOUBLE:
+    for (; p + sizeof(double) <= e; p += sizeof(double)) {
+      double d;
+      memcpy(&d, p, sizeof(double));
+      if (cnt++) values << ',';
+      write_double(values, d);
+    }
+    break;
+  }
+
+  if (cnt == 1) {
+    os << values.rdbuf();
+  } else {
+    os << '[' << values.rdbuf() << ']';
+  }
+}
+
+
+static void
+write_json(ostream &os, const lsb_heka_message &m)
+{
+  static const char hex[] = "0123456789abcdef";
+  os << "{\"Uuid\":\"";
+  for (size_t i = 0; i < m.uuid.len; ++i) {
+    unsigned char c = static_cast<unsigned char>(m.uuid.s[i]);
+    if (i == 4 || i == 6 || i == 8 || i == 10) os << '-';
+    os << hex[c >> 4] << hex[c & 0xf];
+  }
+  os << "\",\"Timestamp\":" << m.timestamp;
+  os << ",\"Type\":";
+  write_json_string(os, m.type.s, m.type.len);
+  os << ",\"Logger\":";
+  write_json_string(os, m.logger.s, m.logger.len);
+  os << ",\"Severity\":" << m.severity;
+  os << ",\"Payload\":";
+  write_json_string(os, m.payload.s, m.payload.len);
+  os << ",\"EnvVersion\":";
+  write_json_string(os, m.env_version.s, m.env_version.len);
+  if (m.pid != INT_MIN) {
+    os << ",\"Pid\":" << m.pid;
+  }
+  os << ",\"Hostname\":";
+  write_json_string(os, m.hostname.s, m.hostname.len);
+  os << ",\"Fields\":{";
+  for (int i = 0; i < m.fields_len; ++i) {
+    if (i) os << ',';
+    write_json_string(os, m.fields[i].name.s, m.fields[i].name.len);
+    os << ':';
+    write_field_value(os, m.fields[i]);
+  }
+  os << "}}\n";
+}
+
+
+hs::message_export::message_export(Wt::WObject *parent) :
+    Wt::WResource(parent) { }
+
+
+hs::message_export::~message_export()
+{
+  beingDeleted(); // waits for the requests in progress
+}
+
+
+void hs::message_export::configure(const settings &s)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_settings = make_shared<settings>(s);
+  }
+  suggestFileName(s.fmt == ndjson ? "matches.ndjson" : "matches.log"); // as an attachment
+  setChanged();
+}
+
+
+void hs::message_export::handleRequest(const Wt::Http::Request &request,
+                                       Wt::Http::Response &response)
+{
+  shared_ptr<export_state> st;
+  Wt::Http::ResponseContinuation *c = request.continuation();
+  if (c) {
+    st = boost::any_cast<shared_ptr<export_state> >(c->data());
+  } else {
+    st = make_shared<export_state>();
+    {
+      lock_guard<mutex> lock(m_mutex);
+      st->settings = m_settings;
+    }
+    if (!st->settings) {
+      response.setStatus(404);
+      return;
+    }
+    for (unsigned q = scan_options::input_queue; q <= scan_options::analysis_queue; q <<= 1) {
+      if (!(st->settings->queues & q)) continue;
+      auto files = checkpointed_files(st->settings->path, q);
+      st->files.insert(st->files.end(), files.begin(), files.end());
+    }
+    response.setMimeType(st->settings->fmt == ndjson ? "application/x-ndjson"
+                         : "application/octet-stream");
+  }
+
+  const settings &s = *st->settings;
+  ostream &os = response.out();
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  size_t written = 0;
+  size_t scanned = 0;
+  while (st->file < st->files.size() && written < g_chunk_bytes && scanned < g_scan_bytes) {
+    heka_scanner scanner;
+    if (!scanner.open(st->files[st->file].first, s.max_message_size)) {
+      ++st->file; // removed by hindsight since the export started
+      st->offset = 0;
+      continue;
+    }
+    size_t end = min(st->files[st->file].second, scanner.size());
+    scanner.seek(st->offset);
+    bool done = true;
+    while (scanner.next(&m) && scanner.offset() < end) {
+      if (m.timestamp >= s.since && lsb_eval_message_matcher(s.mm.get(), &m)) {
+        size_t len = scanner.position() - scanner.offset();
+        if (s.fmt == heka_framed) {
+          // the frame as it is in the queue file
+          os.write(scanner.data() + scanner.offset(), len);
+        } else {
+          write_json(os, m);
+        }
+        written += len;
+      }
+      if (written >= g_chunk_bytes || scanned + scanner.position() - st->offset >= g_scan_bytes) {
+        done = scanner.position() >= end;
+        break;
+      }
+    }
+    scanned += scanner.position() - st->offset;
+    if (done) {
+      ++st->file;
+      st->offset = 0;
+    } else {
+      st->offset = scanner.position();
+    }
+  }
+  lsb_free_heka_message(&m);
+
+  if (st->file < st->files.size()) {
+    c = response.createContinuation();
+    c->setData(st);
+  }
+}
@@ -0,0 +1,70 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Matched Message Export @file
+
+#ifndef hindsight_admin_message_export_h_
+#define hindsight_admin_message_export_h_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <Wt/WResource>
+#include <boost/filesystem.hpp>
+
+#include "matcher_cache.h"
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Download of every message matching an expression, oldest first, as NDJSON
+ * or as the original Heka framing. The queue files are walked in place and
+ * the response is written in chunks through response continuations so the
+ * export never holds more than one chunk in memory.
+ */
+class message_export : public Wt::WResource {
+public:
+  enum format {
+    ndjson,
+    heka_framed
+  };
+
+  struct settings {
+    settings() : queues(0), since(0), max_message_size(0), fmt(ndjson) { }
+
+    boost::filesystem::path path;   // hindsight output_path
+    compiled_matcher        mm;
+    unsigned                queues; // scan_options queue bits
+    int64_t                 since;  // ns, 0 for the whole queue
+    size_t                  max_message_size;
+    format                  fmt;
+  };
+
+  message_export(Wt::WObject *parent = 0);
+  ~message_export();
+
+  /**
+   * Sets what the next download exports (downloads in progress keep their
+   * settings) and gives the resource a new URL.
+   */
+  void configure(const settings &s);
+
+protected:
+  void handleRequest(const Wt::Http::Request &request, Wt::Http::Response &response);
+
+private:
+  std::mutex                        m_mutex;
+  std::shared_ptr<const settings>   m_settings;
+};
+
+}
+}
+}
+#endif
@@ -9,6 +9,7 @@
 #ifndef hindsight_admin_output_tester_h_
 #define hindsight_admin_output_tester_h_
 
+#include <memory>
 #include <string>
 #include <sstream>
 
@@ -35,8 +36,7 @@ namespace hindsight {
 
 class output_tester : public Wt::WContainerWidget {
 public:
-  output_tester(session *s, const hindsight_cfg *hs_cfg, plugins *p);
-  ~output_tester();
+  output_tester(session *s, const services *svc, plugins *p);
   void append_log(const char *s);
 
 private:
@@ -44,6 +44,7 @@ private:
   void test_plugin();
   void deploy_plugin();
   void run_matcher();
+  void show_matches(const std::shared_ptr<const scan_result> &r);
   void disable_deploy();
   bool test_init();
   Wt::WWidget* message_matcher();
@@ -52,6 +53,7 @@ private:
   void selection_changed(Wt::WString name);
 
   session             *m_session;
+  const services      *m_services;
   const hindsight_cfg *m_hs_cfg;
   plugins             *m_plugins;
   Wt::WMessageBox     *m_message_box;
@@ -59,7 +61,10 @@ private:
 
   // pointers managed by the container
   Wt::WTextArea         *m_cfg;
-  Wt::WContainerWidget  *m_msgs;
+  Wt::WComboBox         *m_queues;
+  Wt::WSpinBox          *m_samples;
+  scan_job              *m_job;
+  message_browser       *m_msgs;
   Wt::WContainerWidget  *m_debug;
   Wt::WTextArea         *m_logs;
   Wt::WPushButton       *m_deploy;
@@ -68,8 +73,7 @@ private:
   // end managed pointers
 
   Wt::Signals::connection m_cfg_sig;
-  struct input_msg m_inputs[g_max_messages];
-  int m_inputs_cnt;
+  std::shared_ptr<const scan_result> m_inputs;
 };
 
 }
@@ -16,7 +16,7 @@
 #include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/regex.hpp>
+#include <Wt/WApplication>
 #include <Wt/WContainerWidget>
 #include <Wt/WLink>
 #include <Wt/WMenuItem>
@@ -25,200 +25,164 @@
 #include <Wt/WPopupMenuItem>
 #include <Wt/WPushButton>
 #include <Wt/WScrollArea>
-#include <Wt/WStandardItem>
 #include <Wt/WText>
 #include <Wt/WVBoxLayout>
 #include <Wt/WViewWidget>
 
 #include "constants.h"
+#include "stats_chart.h"
 
 using namespace std;
 namespace hs = mozilla::services::hindsight;
 namespace fs = boost::filesystem;
 
-hs::plugins::plugins(hs::session *s, const hindsight_cfg *cfg) :
+hs::plugins::plugins(hs::session *s, const hindsight_cfg *cfg, stats_collector *stats) :
     m_session(s),
     m_hs_cfg(cfg),
-    m_stats(0, stat_columns + 2),
+    m_collector(stats),
+    m_subscription(-1),
+    m_cells_changed(0),
+    m_rows_changed(0),
+    m_bytes_changed(0),
     m_popup(nullptr)
 {
-  m_stats.setHeaderData(0, Wt::Horizontal, tr("state"));
-  m_stats.setHeaderData(1, Wt::Horizontal, tr("type"));
-  m_stats.setHeaderData(2, Wt::Horizontal, tr("plugin_name"));
-  m_stats.setHeaderData(3, Wt::Horizontal, tr("im_count"));
-  m_stats.setHeaderData(4, Wt::Horizontal, tr("im_bytes"));
-  m_stats.setHeaderData(5, Wt::Horizontal, tr("pm_count"));
-  m_stats.setHeaderData(6, Wt::Horizontal, tr("pm_failures"));
-  m_stats.setHeaderData(7, Wt::Horizontal, tr("cur_mem"));
-  m_stats.setHeaderData(8, Wt::Horizontal, tr("max_mem"));
-  m_stats.setHeaderData(9, Wt::Horizontal, tr("max_output"));
-  m_stats.setHeaderData(10, Wt::Horizontal, tr("max_inst"));
-  m_stats.setHeaderData(11, Wt::Horizontal, tr("mm_avg"));
-  m_stats.setHeaderData(12, Wt::Horizontal, tr("mm_sd"));
-  m_stats.setHeaderData(13, Wt::Horizontal, tr("pm_avg"));
-  m_stats.setHeaderData(14, Wt::Horizontal, tr("pm_sd"));
-  m_stats.setHeaderData(15, Wt::Horizontal, tr("te_avg"));
-  m_stats.setHeaderData(16, Wt::Horizontal, tr("te_sd"));
   this->addWidget(create_view());
+  m_status = new Wt::WText(this);
+  m_status->setStyleClass("refresh_stats");
+  show_refresh_stats();
 }
 
 
-void hs::plugins::load_run_path(const fs::path &dir)
+hs::plugins::~plugins()
 {
-  fs::path run_path(m_hs_cfg->m_hs_run / dir);
-  boost::smatch matches;
-  for (fs::directory_iterator dit(run_path); dit != fs::directory_iterator(); ++dit) {
-    string fn(dit->path().filename().string());
-    if (boost::regex_match(fn, matches, boost::regex("(.+)\\.(off|cfg)$"))) {
-      vector<Wt::WStandardItem *> items;
-      Wt::WStandardItem *item = new Wt::WStandardItem();
-      if (string(matches[2].first, matches[2].second) == "off") {
-        item->setData(tr("stopped"), Wt::DisplayRole);
-        item->setData(LSB_STOP, Wt::UserRole);
-      } else {
-        item->setData(tr("unknown"), Wt::DisplayRole);
-        item->setData(LSB_UNKNOWN, Wt::UserRole);
-      }
-      items.push_back(item);
-
-      item = new Wt::WStandardItem();
-      item->setData(dir.string(), Wt::DisplayRole);
-      items.push_back(item);
+  m_collector->unsubscribe(m_subscription);
+  delete m_popup;
+}
 
-      item = new Wt::WStandardItem();
-      item->setData(string(matches[1].first, matches[1].second), Wt::DisplayRole);
-      items.push_back(item);
 
-      for (int col = 1; col < stat_columns; ++col) {
-        item = new Wt::WStandardItem();
-        item->setData(0.0, Wt::DisplayRole);
-        items.push_back(item);
-      }
-      m_stats.appendRow(items);
-    }
-  }
+void hs::plugins::refresh()
+{
+  load_stats();
+  show_refresh_stats();
+  Wt::WApplication::instance()->triggerUpdate();
 }
 
 
-int hs::plugins::add_new_row(const std::string &ptype,
-                             const std::string &pname,
-                             lsb_state state)
+void hs::plugins::show_refresh_stats()
 {
-  vector<Wt::WStandardItem *> items;
-  Wt::WStandardItem *item = new Wt::WStandardItem();
-  item->setData(state, Wt::UserRole);
-  if (state == LSB_RUNNING) {
-    item->setData(tr("running"), Wt::DisplayRole);
-    item->setStyleClass("running");
-  } else if (state == LSB_UNKNOWN - 1) {
-    item->setData(tr("deploying"), Wt::DisplayRole);
-    item->setStyleClass("deploying");
-  } else {
-    item->setData(tr("unknown"), Wt::DisplayRole);
-    item->setStyleClass("unknown");
-  }
-  items.push_back(item);
-
-  item = new Wt::WStandardItem();
-  item->setData(ptype, Wt::DisplayRole);
-  items.push_back(item);
+  m_status->setText(tr("refresh_stats").arg(m_cells_changed).arg(m_rows_changed)
+                    .arg(static_cast<int>(m_bytes_changed)));
+}
 
-  item = new Wt::WStandardItem();
-  item->setData(pname, Wt::DisplayRole);
-  items.push_back(item);
 
-  for (int col = 1; col < stat_columns; ++col) {
-    item = new Wt::WStandardItem();
-    item->setData(0.0, Wt::DisplayRole);
-    items.push_back(item);
+void hs::plugins::load_run_path(const fs::path &dir)
+{
+  auto listing = m_collector->get_dirs()->get(m_hs_cfg->m_hs_run / dir);
+  for (auto it = listing->files.begin(); it != listing->files.end(); ++it) {
+    const string &fn = *it;
+    size_t len = fn.size();
+    if (len < 5 || fn[len - 4] != '.') continue;
+    bool off = fn.compare(len - 3, 3, "off") == 0;
+    if (!off && fn.compare(len - 3, 3, "cfg") != 0) continue;
+
+    string pname(fn, 0, len - 4);
+    int row = m_stats.find(dir.string(), pname);
+    if (row < 0) {
+      m_stats.add(dir.string(), pname, off ? LSB_STOP : LSB_UNKNOWN);
+    } else if (off) { // both the .cfg and the .off exist
+      m_stats.set_state(row, LSB_STOP);
+    }
   }
-  m_stats.appendRow(items);
-  return m_stats.rowCount() - 1;
 }
 
 
 int hs::plugins::find_create(const std::string plugin, lsb_state state)
 {
-  size_t pos   = plugin.find_first_of(".");
-  string ptype = plugin.substr(0, pos);
-  string pname = plugin.substr(pos + 1);
+  size_t pos = plugin.find_first_of(".");
+  return find_create(plugin.substr(0, pos), plugin.substr(pos + 1), state);
+}
 
-  int rows = m_stats.rowCount();
-  for (int row = 0; row < rows; ++row) {
-    string ptype1(boost::any_cast<string>(m_stats.item(row, 1)->data(Wt::DisplayRole)));
-    string pname1(boost::any_cast<string>(m_stats.item(row, 2)->data(Wt::DisplayRole)));
-    if (ptype == ptype1 && pname == pname1) {
-      m_stats.item(row)->setData(LSB_RUNNING, Wt::UserRole);
-      m_stats.item(row)->setData(tr("running"), Wt::DisplayRole);
-      m_stats.item(row)->setStyleClass("running");
-      return row;
-    }
+
+int hs::plugins::find_create(const std::string &ptype, const std::string &pname, lsb_state state)
+{
+  int row = m_stats.find(ptype, pname);
+  if (row >= 0) {
+    m_stats.set_state(row, LSB_RUNNING);
+    return row;
   }
-  return add_new_row(ptype, pname, state);
+  return m_stats.add(ptype, pname, state);
 }
 
 
-
 void hs::plugins::load_stats()
 {
-  if (m_hs_cfg->m_plugins.empty()) return;
+  shared_ptr<const plugins_snapshot> snapshot = m_collector->get_plugins();
+  if (snapshot == m_snapshot) return;
+  m_snapshot = snapshot;
+  m_cells_changed = 0;
+  m_rows_changed = 0;
+  m_bytes_changed = 0;
+
+  vector<char> seen(m_stats.rowCount(), 0);
+  for (auto it = snapshot->rows.begin(); it != snapshot->rows.end(); ++it) {
+    int row = m_stats.find(it->type, it->name);
+    if (row < 0) {
+      row = m_stats.add(it->type, it->name, LSB_RUNNING);
+      seen.resize(row + 1, 0);
+      ++m_rows_changed;
+    } else if (m_stats.set_state(row, LSB_RUNNING)) {
+      ++m_cells_changed;
+    }
+    seen[row] = 1;
+    m_cells_changed += m_stats.set_stats(row, *it, &m_bytes_changed);
+  }
 
-  bool header = true;
-  int cnt     = 0;
-  string s;
-  ifstream ifs(m_hs_cfg->m_plugins.string().c_str());
-  vector<string> cols;
+  // one listing (and stat) per plugin directory rather than per plugin file
+  typedef pair<shared_ptr<const dir_snapshot>, shared_ptr<const dir_snapshot> > run_load;
+  unordered_map<string, run_load> dirs;
+  dir_cache *cache = m_collector->get_dirs();
 
   int rows = m_stats.rowCount();
+  vector<char> removed(rows, 0);
   for (int i = 0; i < rows; ++i) {
-    int state = boost::any_cast<lsb_state>(m_stats.item(i)->data());
-    if (state == LSB_RUNNING) {
-      m_stats.item(i)->setData(LSB_UNKNOWN, Wt::UserRole); // state flag
+    if (seen[i]) continue;
+
+    const string &ptype = m_stats.type(i);
+    const string &pname = m_stats.name(i);
+    auto di = dirs.find(ptype);
+    if (di == dirs.end()) {
+      run_load rl(cache->get(m_hs_cfg->m_hs_run / ptype),
+                  m_hs_cfg->m_hs_load.empty() ? make_shared<dir_snapshot>()
+                  : cache->get(m_hs_cfg->m_hs_load / ptype));
+      di = dirs.insert(make_pair(ptype, rl)).first;
     }
-  }
-
-  while (getline(ifs, s).good()) {
-    boost::split(cols, s, boost::is_any_of("\t"));
-    cnt = cols.size();
-    if (cnt < stat_columns) continue;
-
-    if (header) {
-      header = false;
+    const dir_snapshot &run = *di->second.first;
+    const dir_snapshot &load = *di->second.second;
+
+    int state = LSB_UNKNOWN;
+    if (run.has(pname + ".err")) {
+      state = LSB_TERMINATED;
+    } else if (run.has(pname + ".off")) {
+      state = LSB_STOP;
+    } else if (!load.has(pname + ".cfg") && !run.has(pname + ".cfg")) {
+      removed[i] = 1;
+      continue;
+    } else if (m_stats.state(i) != LSB_RUNNING) {
       continue;
     }
-
-    int row = find_create(cols[0], LSB_RUNNING);
-    for (int col = 1; col < stat_columns; ++col) {
-      m_stats.item(row, col + 2)->setData(boost::lexical_cast<double>(cols[col]),
-                                          Wt::DisplayRole);
+    if (m_stats.set_state(i, state)) {
+      ++m_cells_changed;
     }
   }
 
-  rows = m_stats.rowCount();
-  for (int i = 0; i < rows; ++i) {
-    Wt::WStandardItem *item = m_stats.item(i);
-    int state = boost::any_cast<lsb_state>(item->data());
-    if (state != LSB_RUNNING) {
-      string ptype(boost::any_cast<string>(m_stats.item(i, 1)->data(Wt::DisplayRole)));
-      string pname(boost::any_cast<string>(m_stats.item(i, 2)->data(Wt::DisplayRole)));
-      if (fs::exists(m_hs_cfg->m_hs_run / ptype / (pname + ".err"))) {
-        item->setData(tr("terminated"), Wt::DisplayRole);
-        item->setData(LSB_TERMINATED, Wt::UserRole);
-        item->setStyleClass("terminated");
-      } else if (fs::exists(m_hs_cfg->m_hs_run / ptype / (pname + ".off"))) {
-        item->setData(tr("stopped"), Wt::DisplayRole);
-        item->setData(LSB_STOP, Wt::UserRole);
-        item->setStyleClass("stopped");
-      } else if (!fs::exists(m_hs_cfg->m_hs_load / ptype / (pname + ".cfg")) &&
-                 !fs::exists(m_hs_cfg->m_hs_run / ptype / (pname + ".cfg"))) {
-        auto items = m_stats.takeRow(i);
-        for (auto ci = items.begin(); ci != items.end(); ++ci) {
-          delete(*ci);
-        }
-        --i;
-        --rows;
-      }
-    }
+  // remove the vanished plugins a contiguous run at a time, last run first
+  for (int i = rows - 1; i >= 0; --i) {
+    if (!removed[i]) continue;
+    int first = i;
+    while (first > 0 && removed[first - 1]) --first;
+    m_stats.removeRows(first, i - first + 1);
+    m_rows_changed += i - first + 1;
+    i = first;
   }
 }
 
@@ -245,9 +209,15 @@ Wt::WTableView* hs::plugins::create_view()
   m_view->setSortingEnabled(0, false); // todo fix PKc error
   m_view->setColumnWidth(1, 55);
   m_view->setColumnWidth(2, 150);
-  for (int i = 3; i < stat_columns + 2; ++i) {
+  const int rates = plugins_model::first_stat + plugin_stats::columns;
+  for (int i = plugins_model::first_stat; i < rates; ++i) {
     m_view->setColumnWidth(i, 80);
   }
+  for (int i = rates; i < plugins_model::trend_column; ++i) {
+    m_view->setColumnWidth(i, 70);
+  }
+  m_view->setColumnWidth(plugins_model::trend_column, 140);
+  m_view->setSortingEnabled(plugins_model::trend_column, false);
   m_view->setSelectionMode(Wt::SingleSelection);
   /*
    * To support right-click, we need to disable the built-in browser
@@ -259,9 +229,9 @@ Wt::WTableView* hs::plugins::create_view()
   m_view->setAttributeValue("oncontextmenu", "event.cancelBubble = true; event.returnValue = false; return false;");
   m_view->mouseWentUp().connect(this, &hs::plugins::popup);
 
-  m_timer.setInterval(6000);
-  m_timer.timeout().connect(this, &hs::plugins::load_stats);
-  m_timer.start();
+  m_subscription = m_collector->subscribe(stats_collector::plugins_file,
+                                          Wt::WApplication::instance()->sessionId(),
+                                          std::bind(&hs::plugins::refresh, this));
   return m_view;
 }
 
@@ -276,15 +246,16 @@ void hs::plugins::popup(const Wt::WModelIndex &item, const Wt::WMouseEvent &even
       m_popup = NULL;
     }
     int row = m_filter->mapToSource(item).row();
-    int state = boost::any_cast<lsb_state>(m_stats.data(row, 0, Wt::UserRole));
+    int state = m_stats.state(row);
     if (state <= 0) {
       return;
     }
 
-    string plugin(boost::any_cast<string>(m_stats.data(row, 2, Wt::DisplayRole)));
+    string plugin(m_stats.name(row));
     m_popup = new Wt::WPopupMenu();
     m_popup->setAutoHide(true, 10);
     m_popup->addItem(tr("view_lua"))->setData(reinterpret_cast<void *>(lua));
+    m_popup->addItem(tr("view_history"))->setData(reinterpret_cast<void *>(history));
 
     if (state == LSB_TERMINATED) {
       m_popup->addItem(tr("view_termination_error"))->setData(reinterpret_cast<void *>(err));
@@ -408,6 +379,23 @@ void hs::plugins::popup_action()
       }
       break;
 
+    case history:
+      {
+        Wt::WMessageBox *mb = new Wt::WMessageBox();
+        mb->setWindowTitle(ptype + "." + plugin);
+        mb->setClosable(true);
+        mb->contents()->addWidget(new stats_chart(m_collector, stats_collector::plugins_file,
+                                                  ptype + "." + plugin));
+        mb->setModal(false);
+        mb->buttonClicked().connect(std::bind([=]()
+        {
+          delete mb;
+        }));
+
+        mb->show();
+      }
+      break;
+
     case stop:
       {
         Wt::WString title(tr("success"));
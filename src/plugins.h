@@ -18,6 +18,7 @@ extern "C"
 }
 #endif
 
+#include <memory>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -25,16 +26,16 @@ extern "C"
 #include <Wt/WPanel>
 #include <Wt/WPopupMenu>
 #include <Wt/WSortFilterProxyModel>
-#include <Wt/WStandardItem>
-#include <Wt/WStandardItemModel>
 #include <Wt/WTableView>
 #include <Wt/WTabWidget>
-#include <Wt/WTimer>
+#include <Wt/WText>
 #include <Wt/WViewWidget>
 
 #include "cfg_viewer.h"
 #include "hindsight_admin.h"
+#include "plugins_model.h"
 #include "source_viewer.h"
+#include "stats_collector.h"
 
 namespace mozilla {
 namespace services {
@@ -42,8 +43,8 @@ namespace hindsight {
 
 class plugins : public Wt::WContainerWidget {
 public:
-  plugins(session *s, const hindsight_cfg *cfg);
-  ~plugins() { delete m_popup;}
+  plugins(session *s, const hindsight_cfg *cfg, stats_collector *stats);
+  ~plugins();
 
   int find_create(const std::string plugin, lsb_state state);
 
@@ -51,11 +52,13 @@ private:
   Wt::WTableView* create_view();
   void load_run_path(const boost::filesystem::path &dir);
   void load_stats();
+  void refresh();
+  void show_refresh_stats();
+  int find_create(const std::string &ptype, const std::string &pname, lsb_state state);
 
   void message_box_dismissed();
   void popup(const Wt::WModelIndex &item, const Wt::WMouseEvent &event);
   void popup_action();
-  int add_new_row(const std::string &ptype, const std::string &pname, lsb_state state);
 
   enum popup_actions {
     cfg,
@@ -65,15 +68,20 @@ private:
     restart,
     edit,
     del,
+    history,
   };
 
-  static const int stat_columns = 15;
   session *m_session;
   const hindsight_cfg *m_hs_cfg;
+  stats_collector *m_collector;
+  int             m_subscription;
+  std::shared_ptr<const plugins_snapshot> m_snapshot;
+  int             m_cells_changed;  // by the last refresh
+  int             m_rows_changed;   // added or removed by the last refresh
+  size_t          m_bytes_changed;  // display text of the changed cells
 
   boost::filesystem::path m_file;
-  Wt::WTimer              m_timer;
-  Wt::WStandardItemModel  m_stats;
+  plugins_model           m_stats;
   Wt::WPopupMenu          *m_popup;
   Wt::WMessageBox         *m_message_box;
 
@@ -81,6 +89,7 @@ private:
   Wt::WSortFilterProxyModel *m_filter;
   Wt::WTableView            *m_view;
   source_viewer             *m_sv;
+  Wt::WText                 *m_status;
 // end managed pointers
 };
 
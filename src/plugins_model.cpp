@@ -0,0 +1,252 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Plugins Table Model Implementation @file
+
+#include "plugins_model.h"
+
+#include <cmath>
+
+#include <Wt/WString>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+static const char *g_headers[] = {
+  "state", "type", "plugin_name", "im_count", "im_bytes", "pm_count",
+  "pm_failures", "cur_mem", "max_mem", "max_output", "max_inst", "mm_avg",
+  "mm_sd", "pm_avg", "pm_sd", "te_avg", "te_sd", "im_rate", "pm_rate",
+  "pm_failure_rate", "trend"
+};
+static const int g_columns = sizeof(g_headers) / sizeof(g_headers[0]);
+
+
+static const char* state_id(int state)
+{
+  switch (state) {
+  case LSB_RUNNING:
+    return "running";
+  case LSB_TERMINATED:
+    return "terminated";
+  case LSB_STOP:
+    return "stopped";
+  case hs::plugins_model::deploying:
+    return "deploying";
+  default:
+    return "unknown";
+  }
+}
+
+
+hs::plugins_model::plugins_model(Wt::WObject *parent) :
+    Wt::WAbstractTableModel(parent),
+    m_indexed(0),
+    m_values(value_columns) { }
+
+
+int hs::plugins_model::columnCount(const Wt::WModelIndex &parent) const
+{
+  return parent.isValid() ? 0 : g_columns;
+}
+
+
+int hs::plugins_model::rowCount(const Wt::WModelIndex &parent) const
+{
+  return parent.isValid() ? 0 : static_cast<int>(m_state.size());
+}
+
+
+boost::any hs::plugins_model::data(const Wt::WModelIndex &index, int role) const
+{
+  int row = index.row();
+  int col = index.column();
+  if (col == 0) {
+    switch (role) {
+    case Wt::DisplayRole:
+      return Wt::WString::tr(state_id(m_shown[row]));
+    case Wt::UserRole:
+      return static_cast<lsb_state>(m_state[row]);
+    case Wt::StyleClassRole:
+      return Wt::WString(state_id(m_shown[row]));
+    default:
+      return boost::any();
+    }
+  }
+  if (role != Wt::DisplayRole) {
+    return boost::any();
+  }
+
+  if (col == 1) {
+    return type(row);
+  } else if (col == 2) {
+    return name(row);
+  } else if (col < trend_column) {
+    return m_values[col - first_stat][row];
+  }
+  return Wt::WString::fromUTF8(m_trend[row]);
+}
+
+
+boost::any hs::plugins_model::headerData(int section, Wt::Orientation orientation, int role) const
+{
+  if (orientation != Wt::Horizontal || role != Wt::DisplayRole || section < 0
+      || section >= g_columns) {
+    return boost::any();
+  }
+  return Wt::WString::tr(g_headers[section]);
+}
+
+
+bool hs::plugins_model::removeRows(int row, int count, const Wt::WModelIndex &parent)
+{
+  int rows = rowCount();
+  if (parent.isValid() || row < 0 || count <= 0 || row + count > rows) {
+    return false;
+  }
+
+  beginRemoveRows(parent, row, row + count - 1);
+  for (int i = row; i < row + count; ++i) {
+    m_index.erase(key(i));
+    release(m_type[i]);
+    release(m_name[i]);
+  }
+  m_type.erase(m_type.begin() + row, m_type.begin() + row + count);
+  m_name.erase(m_name.begin() + row, m_name.begin() + row + count);
+  m_state.erase(m_state.begin() + row, m_state.begin() + row + count);
+  m_shown.erase(m_shown.begin() + row, m_shown.begin() + row + count);
+  for (auto it = m_values.begin(); it != m_values.end(); ++it) {
+    it->erase(it->begin() + row, it->begin() + row + count);
+  }
+  m_trend.erase(m_trend.begin() + row, m_trend.begin() + row + count);
+  if (row < m_indexed) {
+    m_indexed = row; // the rows after it moved, re-keyed by the next find
+  }
+  endRemoveRows();
+  return true;
+}
+
+
+int hs::plugins_model::find(const string &ptype, const string &pname) const
+{
+  auto t = m_string_ids.find(ptype);
+  auto n = m_string_ids.find(pname);
+  if (t == m_string_ids.end() || n == m_string_ids.end()) {
+    return -1;
+  }
+  reindex();
+  auto it = m_index.find(static_cast<uint64_t>(t->second) << 32 | n->second);
+  return it == m_index.end() ? -1 : it->second;
+}
+
+
+int hs::plugins_model::add(const string &ptype, const string &pname, int state)
+{
+  int row = rowCount();
+  beginInsertRows(Wt::WModelIndex(), row, row);
+  m_type.push_back(intern(ptype));
+  m_name.push_back(intern(pname));
+  m_state.push_back(state);
+  m_shown.push_back(state);
+  for (auto it = m_values.begin(); it != m_values.end(); ++it) {
+    it->push_back(0);
+  }
+  m_trend.push_back(string());
+  if (m_indexed == row) {
+    m_index[key(row)] = row;
+    ++m_indexed;
+  }
+  endInsertRows();
+  return row;
+}
+
+
+bool hs::plugins_model::set_state(int row, int state)
+{
+  m_state[row] = state;
+  if (state == LSB_UNKNOWN || m_shown[row] == state) {
+    return false;
+  }
+  m_shown[row] = state;
+  dataChanged().emit(index(row, 0), index(row, 0));
+  return true;
+}
+
+
+int hs::plugins_model::set_stats(int row, const plugin_stats &ps, size_t *bytes)
+{
+  int first = -1;
+  int last = -1;
+  int changed = 0;
+  for (int i = 0; i < value_columns; ++i) {
+    double v;
+    if (i < plugin_stats::columns) {
+      v = ps.values[i];
+    } else {
+      v = ps.rate[i - plugin_stats::columns];
+      if (std::isnan(v)) v = 0;
+    }
+    double &cell = m_values[i][row];
+    if (cell == v) continue;
+
+    cell = v;
+    if (first < 0) first = i + first_stat;
+    last = i + first_stat;
+    ++changed;
+    *bytes += Wt::asString(v).toUTF8().size();
+  }
+
+  if (m_trend[row] != ps.trend) {
+    m_trend[row] = ps.trend;
+    if (first < 0) first = trend_column;
+    last = trend_column;
+    ++changed;
+    *bytes += ps.trend.size();
+  }
+
+  if (changed) {
+    dataChanged().emit(index(row, first), index(row, last));
+  }
+  return changed;
+}
+
+
+uint32_t hs::plugins_model::intern(const string &s)
+{
+  auto it = m_string_ids.find(s);
+  if (it == m_string_ids.end()) {
+    uint32_t id;
+    if (m_free_ids.empty()) {
+      id = static_cast<uint32_t>(m_strings.size());
+      m_strings.push_back(nullptr);
+      m_refs.push_back(0);
+    } else {
+      id = m_free_ids.back();
+      m_free_ids.pop_back();
+    }
+    it = m_string_ids.insert(make_pair(s, id)).first;
+    m_strings[id] = &it->first; // map nodes are stable
+  }
+  ++m_refs[it->second];
+  return it->second;
+}
+
+
+void hs::plugins_model::release(uint32_t id)
+{
+  if (--m_refs[id]) return;
+  m_string_ids.erase(*m_strings[id]);
+  m_strings[id] = nullptr;
+  m_free_ids.push_back(id);
+}
+
+
+void hs::plugins_model::reindex() const
+{
+  int rows = rowCount();
+  for (; m_indexed < rows; ++m_indexed) {
+    m_index[key(m_indexed)] = m_indexed;
+  }
+}
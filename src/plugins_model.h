@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Plugins Table Model @file
+
+#ifndef hindsight_admin_plugins_model_h_
+#define hindsight_admin_plugins_model_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <luasandbox/lua.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <luasandbox.h>
+#include <Wt/WAbstractTableModel>
+
+#include "stats_collector.h"
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Plugins table stored as a struct of arrays: interned type/name ids, the
+ * state and one double array per numeric column. Display strings and style
+ * classes are only produced when the view asks for them. The interned strings
+ * are released with the last row using them and the row index is rebuilt
+ * lazily after removals.
+ *
+ * Columns: state, type, name, the plugins.tsv stats, the rates, the trend.
+ */
+class plugins_model : public Wt::WAbstractTableModel {
+public:
+  static const int first_stat    = 3;
+  static const int value_columns = plugin_stats::columns + plugin_stats::rates;
+  static const int trend_column  = first_stat + value_columns;
+  static const int deploying     = LSB_UNKNOWN - 1;
+
+  plugins_model(Wt::WObject *parent = nullptr);
+
+  virtual int columnCount(const Wt::WModelIndex &parent = Wt::WModelIndex()) const override;
+  virtual int rowCount(const Wt::WModelIndex &parent = Wt::WModelIndex()) const override;
+  virtual boost::any data(const Wt::WModelIndex &index, int role = Wt::DisplayRole) const override;
+  virtual boost::any headerData(int section, Wt::Orientation orientation = Wt::Horizontal,
+                                int role = Wt::DisplayRole) const override;
+  virtual bool removeRows(int row, int count,
+                          const Wt::WModelIndex &parent = Wt::WModelIndex()) override;
+
+  /**
+   * @return int Row of the plugin or -1
+   */
+  int find(const std::string &ptype, const std::string &pname) const;
+
+  /**
+   * Appends a plugin row with zeroed stats.
+   *
+   * @return int New row
+   */
+  int add(const std::string &ptype, const std::string &pname, int state);
+
+  /**
+   * Sets the state of a row. The stale states (LSB_UNKNOWN) keep the last
+   * displayed state.
+   *
+   * @return bool True if the displayed state changed
+   */
+  bool set_state(int row, int state);
+
+  /**
+   * Sets the stats, rates and trend of a row emitting a single dataChanged
+   * for the span of columns that changed.
+   *
+   * @param row Row to update
+   * @param ps Plugin stats
+   * @param bytes Incremented by the display size of the changed cells
+   *
+   * @return int Number of cells that changed
+   */
+  int set_stats(int row, const plugin_stats &ps, size_t *bytes);
+
+  int state(int row) const { return m_state[row]; }
+  const std::string& type(int row) const { return *m_strings[m_type[row]]; }
+  const std::string& name(int row) const { return *m_strings[m_name[row]]; }
+
+private:
+  uint32_t intern(const std::string &s);
+  void release(uint32_t id);
+  void reindex() const;
+  uint64_t key(int row) const
+  {
+    return static_cast<uint64_t>(m_type[row]) << 32 | m_name[row];
+  }
+
+  std::vector<const std::string *>          m_strings;  // interned, by id
+  std::vector<uint32_t>                     m_refs;     // rows using each id
+  std::vector<uint32_t>                     m_free_ids;
+  std::unordered_map<std::string, uint32_t> m_string_ids;
+  mutable std::unordered_map<uint64_t, int> m_index;    // type id, name id -> row
+  mutable int                               m_indexed;  // rows with a valid entry
+
+  std::vector<uint32_t>                     m_type;
+  std::vector<uint32_t>                     m_name;
+  std::vector<int>                          m_state;
+  std::vector<int>                          m_shown;    // displayed state
+  std::vector<std::vector<double> >         m_values;   // by column
+  std::vector<std::string>                  m_trend;
+};
+
+}
+}
+}
+#endif
@@ -0,0 +1,530 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Input Queue Index Implementation @file
+
+#include "queue_index.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Wt/WLogger>
+#include <boost/regex.hpp>
+#include <luasandbox/util/heka_message.h>
+
+#include "file_watcher.h"
+#include "heka_scanner.h"
+#include "hindsight_admin.h"
+#include "matcher_explain.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const char g_magic[4] = { 'H', 'S', 'Q', 'I' };
+static const uint32_t g_version = 1;
+static const size_t g_flush_records = 64 * 1024;
+static const char *g_headers[] = { "Type", "Logger", "Hostname", "EnvVersion" };
+
+
+static uint64_t fnv1a(const char *s, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= static_cast<unsigned char>(s[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+static void bloom_bits(const char *s, size_t len, size_t bits[3])
+{
+  uint64_t h = fnv1a(s, len);
+  uint32_t h1 = static_cast<uint32_t>(h);
+  uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+  for (int k = 0; k < 3; ++k) {
+    bits[k] = (h1 + k * h2) % (hs::queue_index::bloom_words * 64);
+  }
+}
+
+
+static void bloom_add(uint64_t *bloom, const string &s)
+{
+  size_t bits[3];
+  bloom_bits(s.data(), s.size(), bits);
+  for (int k = 0; k < 3; ++k) {
+    bloom[bits[k] / 64] |= 1ULL << (bits[k] % 64);
+  }
+}
+
+
+static bool bloom_test(const uint64_t *bloom, const string &s)
+{
+  size_t bits[3];
+  bloom_bits(s.data(), s.size(), bits);
+  for (int k = 0; k < 3; ++k) {
+    if (!(bloom[bits[k] / 64] & (1ULL << (bits[k] % 64)))) return false;
+  }
+  return true;
+}
+
+
+static bool log_number(const fs::path &log, uint64_t *n)
+{
+  const string stem = log.stem().string();
+  if (log.extension() != ".log" || stem.empty()
+      || stem.find_first_not_of("0123456789") != string::npos) {
+    return false;
+  }
+  *n = strtoull(stem.c_str(), NULL, 10);
+  return true;
+}
+
+
+hs::index_query::index_query() :
+    min_ts(numeric_limits<int64_t>::min()),
+    max_ts(numeric_limits<int64_t>::max())
+{
+  for (int i = 0; i < headers; ++i) {
+    has[i] = false;
+  }
+}
+
+
+hs::index_query hs::index_query::from_matcher(const string &mms)
+{
+  static const boost::regex header_term("^(Type|Logger|Hostname|EnvVersion)\\s*==\\s*"
+                                        "(?:'([^'\\\\]*)'|\"([^\"\\\\]*)\")$");
+  static const boost::regex ts_term("^Timestamp\\s*(==|>=|<=|>|<)\\s*([0-9]{1,18})$");
+
+  index_query q;
+  string op;
+  vector<string> terms = split_terms(mms, &op); // string and regex literals skipped
+  if (op == "||") {
+    return q; // only a conjunction can be narrowed term by term
+  }
+  while (!terms.empty()) {
+    string term = terms.back();
+    terms.pop_back();
+    vector<string> nested = split_terms(term, &op);
+    if (op == "&&") {
+      terms.insert(terms.end(), nested.begin(), nested.end());
+      continue;
+    }
+    if (op == "||") {
+      continue; // an alternative within the conjunction narrows nothing
+    }
+    term = nested[0]; // without its enclosing parentheses
+
+    boost::smatch m;
+    if (boost::regex_match(term, m, header_term)) {
+      for (int i = 0; i < headers; ++i) {
+        if (m[1] == g_headers[i] && !q.has[i]) {
+          q.has[i] = true;
+          q.value[i] = m[2].matched ? m[2].str() : m[3].str();
+        }
+      }
+    } else if (boost::regex_match(term, m, ts_term)) {
+      int64_t v = strtoll(m[2].str().c_str(), NULL, 10);
+      const string cmp = m[1].str();
+      if (cmp == "==" || cmp == ">=") q.min_ts = max(q.min_ts, v);
+      if (cmp == "==" || cmp == "<=") q.max_ts = min(q.max_ts, v);
+      if (cmp == ">") q.min_ts = max(q.min_ts, v + 1);
+      if (cmp == "<") q.max_ts = min(q.max_ts, v - 1);
+    }
+  }
+  return q;
+}
+
+
+bool hs::index_query::empty() const
+{
+  for (int i = 0; i < headers; ++i) {
+    if (has[i]) return false;
+  }
+  return min_ts == numeric_limits<int64_t>::min() && max_ts == numeric_limits<int64_t>::max();
+}
+
+
+hs::queue_index::log_state::~log_state()
+{
+  if (idx_fd >= 0) ::close(idx_fd);
+  if (str_fd >= 0) ::close(str_fd);
+}
+
+
+hs::queue_index::queue_index() :
+    m_hs_cfg(nullptr),
+    m_watcher(nullptr),
+    m_watch_id(-1),
+    m_changed(false),
+    m_stop(false) { }
+
+
+hs::queue_index::~queue_index()
+{
+  stop();
+}
+
+
+void hs::queue_index::start(const hindsight_cfg *cfg, file_watcher *fw, const fs::path &root)
+{
+  boost::system::error_code ec;
+  fs::create_directories(root, ec);
+  if (ec) {
+    Wt::log("error") << "queue_index disabled, could not create: " << root.string() << " "
+        << ec.message();
+    return;
+  }
+  m_hs_cfg = cfg;
+  m_watcher = fw;
+  m_root = root;
+  m_stop = false;
+  m_watch_id = m_watcher->watch(m_hs_cfg->m_hs_output / "input",
+                                IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO,
+                                [this](const string &name, uint32_t mask)
+                                {
+                                  changed(name, mask);
+                                });
+  m_thread = thread(&queue_index::run, this);
+}
+
+
+void hs::queue_index::stop()
+{
+  if (m_watch_id >= 0) {
+    m_watcher->unwatch(m_watch_id);
+    m_watch_id = -1;
+  }
+  {
+    lock_guard<mutex> lock(m_run_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  m_active.clear();
+}
+
+
+void hs::queue_index::changed(const string &, uint32_t)
+{
+  {
+    lock_guard<mutex> lock(m_run_mutex);
+    m_changed = true;
+  }
+  m_cv.notify_all();
+}
+
+
+void hs::queue_index::run()
+{
+  unique_lock<mutex> lock(m_run_mutex);
+  while (!m_stop) {
+    m_changed = false;
+    lock.unlock();
+    build();
+    lock.lock();
+    // hindsight appends continuously, batch the changes into one pass a second
+    m_cv.wait_for(lock, chrono::seconds(1), [this] { return m_stop; });
+    m_cv.wait_for(lock, chrono::seconds(30), [this] { return m_stop || m_changed; });
+  }
+}
+
+
+void hs::queue_index::build()
+{
+  map<uint64_t, fs::path> logs;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(m_hs_cfg->m_hs_output / "input", ec), end;
+       !ec && it != end; it.increment(ec)) {
+    uint64_t n;
+    if (log_number(it->path(), &n)) logs[n] = it->path();
+  }
+
+  uint64_t newest = logs.empty() ? 0 : logs.rbegin()->first;
+  for (auto it = logs.begin(); it != logs.end(); ++it) {
+    struct stat st;
+    if (stat(it->second.string().c_str(), &st)) continue;
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    auto c = m_complete.find(it->first);
+    if (c != m_complete.end() && c->second == size) continue;
+
+    if (index_log(it->first, it->second, size, st.st_ino) && it->first != newest) {
+      // hindsight has moved on, the file will not grow anymore
+      m_complete[it->first] = size;
+      m_active.erase(it->first);
+    }
+  }
+
+  // drop the indexes of the queue files hindsight has removed
+  for (fs::directory_iterator it(m_root, ec), end; !ec && it != end; it.increment(ec)) {
+    const fs::path &fn = it->path();
+    uint64_t n;
+    fs::path log = fn.parent_path() / (fn.stem().string() + ".log");
+    if (!log_number(log, &n) || logs.find(n) != logs.end()) continue;
+    if (fn.extension() == ".idx" || fn.extension() == ".str") {
+      m_active.erase(n);
+      m_complete.erase(n);
+      fs::remove(fn, ec);
+    }
+  }
+}
+
+
+unique_ptr<hs::queue_index::log_state> hs::queue_index::open_state(uint64_t n, uint64_t inode)
+{
+  const string base = (m_root / to_string(n)).string();
+  unique_ptr<log_state> s(new log_state);
+  s->idx_fd = ::open((base + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  s->str_fd = ::open((base + ".str").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (s->idx_fd < 0 || s->str_fd < 0) {
+    Wt::log("error") << "queue_index open failed: " << base << " " << strerror(errno);
+    return nullptr;
+  }
+
+  header &h = s->hdr;
+  bool ok = pread(s->idx_fd, &h, sizeof h, 0) == sizeof h
+      && memcmp(h.magic, g_magic, sizeof g_magic) == 0
+      && h.version == g_version && h.log_inode == inode;
+  vector<char> strs;
+  if (ok) {
+    strs.resize(h.strings_bytes);
+    ok = h.strings_bytes == 0
+        || pread(s->str_fd, &strs[0], strs.size(), 0) == static_cast<ssize_t>(strs.size());
+  }
+  for (size_t pos = 0; ok && pos < strs.size();) {
+    uint32_t len;
+    if (pos + sizeof len > strs.size()) {
+      ok = false;
+      break;
+    }
+    memcpy(&len, &strs[pos], sizeof len);
+    pos += sizeof len;
+    if (pos + len > strs.size()) {
+      ok = false;
+      break;
+    }
+    s->ids.insert(make_pair(string(&strs[pos], len), static_cast<uint32_t>(s->ids.size())));
+    pos += len;
+  }
+  ok = ok && s->ids.size() == h.strings;
+
+  if (!ok) {
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, g_magic, sizeof g_magic);
+    h.version = g_version;
+    h.log_inode = inode;
+    h.min_ts = numeric_limits<int64_t>::max();
+    h.max_ts = numeric_limits<int64_t>::min();
+    s->ids.clear();
+  }
+  // anything past what the header accounts for is an interrupted append
+  if (ftruncate(s->idx_fd, sizeof h + h.records * sizeof(record))
+      || ftruncate(s->str_fd, h.strings_bytes)
+      || pwrite(s->idx_fd, &h, sizeof h, 0) != sizeof h) {
+    Wt::log("error") << "queue_index write failed: " << base << " " << strerror(errno);
+    return nullptr;
+  }
+  s->seen.resize(s->ids.size());
+  return s;
+}
+
+
+bool hs::queue_index::index_log(uint64_t n, const fs::path &log, uint64_t size, uint64_t inode)
+{
+  auto it = m_active.find(n);
+  if (it == m_active.end() || it->second->hdr.log_inode != inode) {
+    unique_ptr<log_state> s = open_state(n, inode);
+    if (!s) return false;
+    m_active[n] = move(s);
+    it = m_active.find(n);
+  }
+  log_state &s = *it->second;
+  header h = s.hdr;
+  if (h.indexed_bytes >= size) {
+    return true;
+  }
+
+  heka_scanner scanner;
+  if (!scanner.open(log, m_hs_cfg->m_max_message_size)) {
+    return false;
+  }
+  scanner.seek(h.indexed_bytes);
+
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  vector<record> records;
+  string strs;
+  bool ok = true;
+  for (bool more = true; more && ok;) {
+    more = scanner.next(&m);
+    if (more) {
+      record r;
+      r.offset = scanner.offset();
+      r.timestamp = m.timestamp;
+      const lsb_const_string *v[index_query::headers] = {
+        &m.type, &m.logger, &m.hostname, &m.env_version
+      };
+      for (int i = 0; i < index_query::headers; ++i) {
+        string val(v[i]->s ? v[i]->s : "", v[i]->s ? v[i]->len : 0);
+        auto id = s.ids.find(val);
+        if (id == s.ids.end()) {
+          id = s.ids.insert(make_pair(val, static_cast<uint32_t>(s.ids.size()))).first;
+          uint32_t len = static_cast<uint32_t>(val.size());
+          strs.append(reinterpret_cast<const char *>(&len), sizeof len);
+          strs.append(val);
+          s.seen.push_back(0);
+        }
+        r.ids[i] = id->second;
+        if (!(s.seen[id->second] & (1 << i))) {
+          s.seen[id->second] |= 1 << i;
+          bloom_add(h.bloom[i], val);
+        }
+      }
+      if (r.timestamp < h.min_ts) h.min_ts = r.timestamp;
+      if (r.timestamp > h.max_ts) h.max_ts = r.timestamp;
+      records.push_back(r);
+    }
+    if (records.size() < g_flush_records && more) continue;
+
+    size_t rbytes = records.size() * sizeof(record);
+    ok = (records.empty()
+          || pwrite(s.idx_fd, &records[0], rbytes, sizeof h + h.records * sizeof(record))
+          == static_cast<ssize_t>(rbytes))
+        && (strs.empty()
+            || pwrite(s.str_fd, strs.data(), strs.size(), h.strings_bytes)
+            == static_cast<ssize_t>(strs.size()));
+    if (ok) {
+      h.records += records.size();
+      h.strings = s.ids.size();
+      h.strings_bytes += strs.size();
+      h.indexed_bytes = scanner.position();
+      lock_guard<mutex> lock(m_mutex);
+      ok = pwrite(s.idx_fd, &h, sizeof h, 0) == sizeof h;
+    }
+    records.clear();
+    strs.clear();
+  }
+  lsb_free_heka_message(&m);
+
+  if (!ok) {
+    Wt::log("error") << "queue_index write failed: " << log.string() << " " << strerror(errno);
+    m_active.erase(it); // reopened and revalidated on the next pass
+    return false;
+  }
+  s.hdr = h;
+  return true;
+}
+
+
+bool hs::queue_index::lookup(const fs::path &log, const index_query &q, index_lookup *r) const
+{
+  uint64_t n;
+  if (q.empty() || m_root.empty() || !log_number(log, &n)) {
+    return false;
+  }
+  const string base = (m_root / to_string(n)).string();
+  int fd = ::open((base + ".idx").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  header h;
+  bool ok;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    ok = pread(fd, &h, sizeof h, 0) == sizeof h;
+  }
+  struct stat st;
+  ok = ok && memcmp(h.magic, g_magic, sizeof g_magic) == 0 && h.version == g_version
+      && h.records > 0 && stat(log.string().c_str(), &st) == 0 && h.log_inode == st.st_ino;
+  if (!ok) {
+    ::close(fd);
+    return false;
+  }
+
+  *r = index_lookup();
+  r->indexed_bytes = h.indexed_bytes;
+  r->skip = q.max_ts < h.min_ts || q.min_ts > h.max_ts;
+  for (int i = 0; i < index_query::headers && !r->skip; ++i) {
+    if (q.has[i] && !bloom_test(h.bloom[i], q.value[i])) r->skip = true;
+  }
+  if (r->skip) {
+    ::close(fd);
+    return true;
+  }
+
+  // resolve the wanted values to ids (a bloom false positive ends here)
+  int64_t want[index_query::headers];
+  int wanted = 0;
+  for (int i = 0; i < index_query::headers; ++i) {
+    want[i] = -1;
+    if (q.has[i]) ++wanted;
+  }
+  if (wanted) {
+    vector<char> strs(h.strings_bytes);
+    int sfd = ::open((base + ".str").c_str(), O_RDONLY | O_CLOEXEC);
+    ok = sfd >= 0 && (strs.empty()
+                      || pread(sfd, &strs[0], strs.size(), 0) == static_cast<ssize_t>(strs.size()));
+    if (sfd >= 0) ::close(sfd);
+    uint32_t id = 0;
+    for (size_t pos = 0; ok && pos + sizeof(uint32_t) <= strs.size(); ++id) {
+      uint32_t len;
+      memcpy(&len, &strs[pos], sizeof len);
+      pos += sizeof len;
+      if (pos + len > strs.size()) break;
+      for (int i = 0; i < index_query::headers; ++i) {
+        if (q.has[i] && q.value[i].size() == len
+            && memcmp(q.value[i].data(), &strs[pos], len) == 0) {
+          want[i] = id;
+        }
+      }
+      pos += len;
+    }
+    if (!ok) {
+      ::close(fd);
+      return false;
+    }
+    for (int i = 0; i < index_query::headers; ++i) {
+      if (q.has[i] && want[i] < 0) r->skip = true;
+    }
+    if (r->skip) {
+      ::close(fd);
+      return true;
+    }
+  }
+
+  size_t size = sizeof h + h.records * sizeof(record);
+  void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    Wt::log("error") << "queue_index mmap failed: " << base << " " << strerror(errno);
+    return false;
+  }
+  const record *rec = reinterpret_cast<const record *>(static_cast<const char *>(map) + sizeof h);
+  for (uint64_t i = 0; i < h.records; ++i) {
+    const record &x = rec[i];
+    if (x.timestamp < q.min_ts || x.timestamp > q.max_ts) continue;
+    bool match = true;
+    for (int j = 0; j < index_query::headers && match; ++j) {
+      match = want[j] < 0 || x.ids[j] == static_cast<uint32_t>(want[j]);
+    }
+    if (match) r->candidates.push_back(x.offset);
+  }
+  munmap(map, size);
+  return true;
+}
@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Input Queue Index @file
+
+#ifndef hindsight_admin_queue_index_h_
+#define hindsight_admin_queue_index_h_
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+struct hindsight_cfg;
+class file_watcher;
+
+/**
+ * The part of a message matcher expression the index can answer: header
+ * equality and Timestamp range terms joined by &&. Anything else is ignored
+ * so the query never excludes a message the matcher would accept.
+ */
+struct index_query {
+  enum header {
+    type,
+    logger,
+    hostname,
+    env_version,
+    headers
+  };
+
+  index_query();
+
+  static index_query from_matcher(const std::string &mms);
+
+  bool empty() const;
+
+  bool        has[headers];
+  std::string value[headers];
+  int64_t     min_ts; // inclusive
+  int64_t     max_ts; // inclusive
+};
+
+
+struct index_lookup {
+  index_lookup() : skip(false), indexed_bytes(0) { }
+
+  bool                  skip;          // nothing in the indexed prefix can match
+  size_t                indexed_bytes; // log prefix covered by the index
+  std::vector<uint64_t> candidates;    // offsets of the records that can match
+};
+
+
+/**
+ * Sidecar index of the input queue (output_path/input/N.log) maintained by
+ * a background thread as hindsight appends. Layout under the root:
+ *   N.idx  header (indexed prefix, min/max timestamp, one bloom filter per
+ *          indexed header) followed by fixed size records {offset,
+ *          timestamp, type, logger, hostname, env_version ids}
+ *   N.str  the ids: length prefixed strings in id order
+ *
+ * Both files are append only and the header is rewritten last so readers can
+ * map the records and strings it accounts for while the index grows.
+ */
+class queue_index {
+public:
+  queue_index();
+  ~queue_index();
+
+  void start(const hindsight_cfg *cfg, file_watcher *fw, const boost::filesystem::path &root);
+  void stop();
+
+  /**
+   * Resolves a query against the index of one queue file.
+   *
+   * @return bool False if the file is not indexed (or the query is empty)
+   */
+  bool lookup(const boost::filesystem::path &log, const index_query &q, index_lookup *r) const;
+
+  static const int bloom_words = 256; // per header, 16 Kbit
+
+  struct header {
+    char      magic[4];
+    uint32_t  version;
+    uint64_t  log_inode;
+    uint64_t  indexed_bytes;
+    uint64_t  records;
+    uint64_t  strings;
+    uint64_t  strings_bytes;
+    int64_t   min_ts;
+    int64_t   max_ts;
+    uint64_t  bloom[index_query::headers][bloom_words];
+  };
+
+  struct record {
+    uint64_t  offset;
+    int64_t   timestamp;
+    uint32_t  ids[index_query::headers];
+  };
+
+private:
+  struct log_state {
+    log_state() : idx_fd(-1), str_fd(-1) { }
+    ~log_state();
+
+    int                                       idx_fd;
+    int                                       str_fd;
+    header                                    hdr;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<uint8_t>                      seen; // by id, headers bloomed
+  };
+
+  void changed(const std::string &name, uint32_t mask);
+  void run();
+  void build();
+  bool index_log(uint64_t n, const boost::filesystem::path &log, uint64_t size, uint64_t inode);
+  std::unique_ptr<log_state> open_state(uint64_t n, uint64_t inode);
+
+  const hindsight_cfg                               *m_hs_cfg;
+  file_watcher                                      *m_watcher;
+  int                                               m_watch_id;
+  boost::filesystem::path                           m_root;
+  std::map<uint64_t, std::unique_ptr<log_state> >   m_active;   // builder thread only
+  std::map<uint64_t, uint64_t>                      m_complete; // log -> indexed size
+
+  mutable std::mutex                                m_mutex;    // header writes
+  std::mutex                                        m_run_mutex;
+  std::condition_variable                           m_cv;
+  bool                                              m_changed;
+  bool                                              m_stop;
+  std::thread                                       m_thread;
+};
+
+}
+}
+}
+#endif
@@ -0,0 +1,173 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Input Queue Tail Implementation @file
+
+#include "queue_tail.h"
+
+#include <cstdlib>
+#include <deque>
+#include <sys/inotify.h>
+
+#include <Wt/WApplication>
+#include <Wt/WServer>
+#include <luasandbox/util/heka_message.h>
+
+#include "file_watcher.h"
+#include "heka_scanner.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const size_t g_max_poll_bytes = 4 * 1024 * 1024; // then yield the session
+
+
+static fs::path log_path(const fs::path &dir, uint64_t n)
+{
+  return dir / (to_string(n) + ".log");
+}
+
+
+/**
+ * @return bool False if the directory has no queue file
+ */
+static bool newest_log(const fs::path &dir, uint64_t *newest)
+{
+  bool found = false;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    const fs::path &fn = it->path();
+    if (fn.extension() != ".log") continue;
+    string stem = fn.stem().string();
+    char *e;
+    unsigned long long n = strtoull(stem.c_str(), &e, 10);
+    if (stem.empty() || *e) continue;
+    if (!found || n > *newest) *newest = n;
+    found = true;
+  }
+  return found;
+}
+
+
+hs::queue_tail::queue_tail(file_watcher *fw) :
+    m_watcher(fw),
+    m_watch_id(-1) { }
+
+
+hs::queue_tail::~queue_tail()
+{
+  stop();
+}
+
+
+bool hs::queue_tail::start(const boost::filesystem::path &dir, const compiled_matcher &mm,
+                           size_t max_message_size, size_t max_matches,
+                           const listener &cb)
+{
+  stop();
+  auto s = make_shared<state>();
+  s->dir = dir;
+  s->mm = mm;
+  s->max_message_size = max_message_size;
+  s->max_matches = max_matches;
+  s->session_id = Wt::WApplication::instance()->sessionId();
+  s->cb = cb;
+  s->file = 0;
+  s->offset = 0;
+  s->pending = false;
+  if (newest_log(dir, &s->file)) {
+    boost::system::error_code ec;
+    uintmax_t size = fs::file_size(log_path(dir, s->file), ec);
+    if (!ec) s->offset = static_cast<size_t>(size);
+  }
+
+  weak_ptr<state> ws = s;
+  m_watch_id = m_watcher->watch(dir, IN_MODIFY | IN_CREATE | IN_MOVED_TO,
+                                [ws](const string &, uint32_t)
+                                {
+                                  changed(ws);
+                                });
+  if (m_watch_id < 0) {
+    return false;
+  }
+  m_state = s;
+  return true;
+}
+
+
+void hs::queue_tail::stop()
+{
+  if (m_watch_id >= 0) {
+    m_watcher->unwatch(m_watch_id); // waits for a callback in progress
+    m_watch_id = -1;
+  }
+  m_state.reset(); // a queued poll finds the state gone
+}
+
+
+void hs::queue_tail::changed(const std::weak_ptr<state> &ws)
+{
+  shared_ptr<state> s = ws.lock();
+  Wt::WServer *server = Wt::WServer::instance();
+  if (!s || !server || s->pending.exchange(true)) {
+    return; // the queued poll will see this change too
+  }
+  server->post(s->session_id, [ws]() { poll(ws); });
+}
+
+
+void hs::queue_tail::poll(const std::weak_ptr<state> &ws)
+{
+  shared_ptr<state> s = ws.lock();
+  if (!s) return;
+  s->pending = false; // changes from now on queue another poll
+
+  deque<string> matches;
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  size_t budget = g_max_poll_bytes;
+  bool more = false;
+  for (;;) {
+    // hindsight only creates the next file once it is done with this one
+    bool rolled = fs::exists(log_path(s->dir, s->file + 1));
+    heka_scanner scanner;
+    if (!scanner.open(log_path(s->dir, s->file), s->max_message_size)) {
+      uint64_t newest;
+      if (newest_log(s->dir, &newest) && newest > s->file) {
+        s->file = newest; // removed from under us
+        s->offset = 0;
+        continue;
+      }
+      break;
+    }
+    if (scanner.size() < s->offset) s->offset = 0; // replaced
+    scanner.seek(s->offset);
+    while (scanner.position() - s->offset < budget && scanner.next(&m)) {
+      if (lsb_eval_message_matcher(s->mm.get(), &m)) {
+        matches.push_back(string(m.raw.s, m.raw.len));
+        if (matches.size() > s->max_matches) matches.pop_front();
+      }
+    }
+    budget -= min(budget, scanner.position() - s->offset);
+    s->offset = scanner.position();
+    if (budget == 0) {
+      more = true;
+      break;
+    }
+    if (!rolled) break;
+    ++s->file;
+    s->offset = 0;
+  }
+  lsb_free_heka_message(&m);
+
+  if (!matches.empty()) {
+    s->cb(vector<string>(matches.begin(), matches.end()), s->file);
+  }
+  if (more) {
+    changed(ws);
+  }
+}
@@ -0,0 +1,83 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Input Queue Tail @file
+
+#ifndef hindsight_admin_queue_tail_h_
+#define hindsight_admin_queue_tail_h_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "matcher_cache.h"
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+class file_watcher;
+
+/**
+ * Follows the active queue file (N.log) of a session: the directory is
+ * watched through the file_watcher and each change is handed to the session
+ * which evaluates the matcher on the frames appended since the last offset
+ * only, rolling over to N+1.log once hindsight has moved on.
+ */
+class queue_tail {
+public:
+  /**
+   * @param matches Raw Heka protobuf of the new matches, oldest first
+   * @param file Number of the queue file being followed
+   */
+  typedef std::function<void(const std::vector<std::string> &matches, uint64_t file)> listener;
+
+  queue_tail(file_watcher *fw);
+  ~queue_tail();
+
+  /**
+   * Starts following at the current end of the newest queue file, stopping
+   * the tail in progress. Must be called on the session thread.
+   *
+   * @param max_matches Only the latest max_matches of a change are delivered
+   *
+   * @return bool False if the directory could not be watched
+   */
+  bool start(const boost::filesystem::path &dir, const compiled_matcher &mm,
+             size_t max_message_size, size_t max_matches, const listener &cb);
+  void stop();
+  bool running() const { return m_state != nullptr; }
+
+private:
+  struct state {
+    boost::filesystem::path dir;
+    compiled_matcher        mm;
+    size_t                  max_message_size;
+    size_t                  max_matches;
+    std::string             session_id;
+    listener                cb;
+    uint64_t                file;     // session thread only
+    size_t                  offset;   // session thread only
+    std::atomic<bool>       pending;  // a poll is queued for the session
+  };
+
+  static void changed(const std::weak_ptr<state> &ws);
+  static void poll(const std::weak_ptr<state> &ws);
+
+  file_watcher            *m_watcher;
+  int                     m_watch_id;
+  std::shared_ptr<state>  m_state;
+};
+
+}
+}
+}
+#endif
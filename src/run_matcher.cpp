@@ -8,219 +8,848 @@
 
 #include "run_matcher.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <string>
 #include <sstream>
-
+#include <unordered_map>
+#include <vector>
+
+#include <Wt/Chart/WCartesianChart>
+#include <Wt/Chart/WDataSeries>
+#include <Wt/WDateTime>
+#include <Wt/WStandardItemModel>
+#include <Wt/WTable>
 #include <Wt/WText>
 #include <Wt/WTree>
 #include <Wt/WPushButton>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/lexical_cast.hpp>
 #include <luasandbox/heka/sandbox.h>
 #include <luasandbox/util/protobuf.h>
 
+#include "heka_scanner.h"
 #include "hindsight_admin.h"
+#include "matcher_explain.h"
+#include "message_browser.h"
+#include "queue_index.h"
+#include "scan_pool.h"
 #include "session.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 namespace hs = mozilla::services::hindsight;
 
-static const char*
-read_string(int wiretype, const char *p, const char *e, lsb_const_string *s)
+const size_t hs::scan_aggregate::top_groups;
+const char *hs::scan_aggregate::other_group = "(other)";
+
+static const struct {
+  const char  *id;
+  int64_t     seconds; // 0 for the whole queue
+} g_windows[] = {
+  { "window_all", 0 },
+  { "window_15m", 15 * 60 },
+  { "window_hour", 3600 },
+  { "window_day", 24 * 3600 }
+};
+
+static const char *g_group_names[] = { "", "Type", "Logger", "Hostname" };
+
+// matcher tab modes: samples, the scan_aggregate groups, explain
+static const int g_explain_mode = 5;
+static const int g_corpus_max_age = 300; // seconds
+
+/**
+ * Reads the writer position ('file:offset') of a queue from the hindsight
+ * checkpoint file.
+ *
+ * @return bool False if there is no usable checkpoint for the queue
+ */
+static bool
+read_checkpoint(const fs::path &path, const char *queue, unsigned long long *file,
+                size_t *offset)
 {
-  if (wiretype != LSB_PB_WT_LENGTH) {
-    return NULL;
+  fs::path cpfn = path / "hindsight.cp";
+  boost::system::error_code ec;
+  if (!fs::exists(cpfn, ec)) return false;
+
+  lua_State *L = luaL_newstate();
+  if (!L) return false;
+
+  lua_pushvalue(L, LUA_GLOBALSINDEX);
+  lua_setglobal(L, "_G");
+
+  if (luaL_dofile(L, cpfn.string().c_str())) {
+    Wt::log("error") << "could not parse the checkpoint file: " << cpfn.string();
+    lua_close(L);
+    return false;
   }
+  lua_getglobal(L, queue);
+  const char *cp = lua_tostring(L, -1);
+  bool ok = cp && sscanf(cp, "%llu:%zu", file, offset) == 2;
+  lua_close(L);
+  return ok;
+}
 
-  long long vi;
-  p = lsb_pb_read_varint(p, e, &vi);
-  if (!p || vi < 0 || p + vi > e) {
-    return NULL;
+
+/**
+ * Lists the N.log files of a queue directory up to max_file in scan priority
+ * order.
+ */
+static vector<pair<unsigned long long, fs::path> >
+list_queue(const fs::path &dir, bool oldest_first, unsigned long long max_file)
+{
+  vector<pair<unsigned long long, fs::path> > files;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    const fs::path &fn = it->path();
+    if (fn.extension() != ".log") continue;
+    const string stem = fn.stem().string();
+    if (stem.empty() || stem.find_first_not_of("0123456789") != string::npos) continue;
+    unsigned long long n = strtoull(stem.c_str(), NULL, 10);
+    if (n > max_file) continue; // rolled after the checkpoint
+    files.push_back(make_pair(n, fn));
   }
-  s->s = p;
-  s->len = (size_t)vi;
-  return p + vi;
+  sort(files.begin(), files.end());
+  if (!oldest_first) {
+    reverse(files.begin(), files.end());
+  }
+  return files;
 }
 
 
-static void
-output_string_values(const char *p, const char *e, stringstream &ss)
+/**
+ * Parses a time of the matcher time range, UTC 'yyyy-MM-dd HH:mm' with
+ * optional seconds.
+ *
+ * @param end Rounds up to the last nanosecond of the minute/second given
+ * @param ns Left as is if the text is empty
+ *
+ * @return bool False if the text is not a time
+ */
+static bool
+parse_time(const Wt::WLineEdit *edit, bool end, int64_t *ns)
 {
-  int acnt = 0;
-  int tag = 0;
-  int wiretype = 0;
-  lsb_const_string s;
-  while (p && p < e) {
-    p = lsb_pb_read_key(p, &tag, &wiretype);
-    p = read_string(wiretype, p, e, &s);
-    if (p) {
-      if (acnt++) ss << ", ";
-      ss << "\"" << std::string(s.s, s.len) << "\"";
+  static const struct {
+    const char  *format;
+    int64_t     seconds; // precision
+  } formats[] = {
+    { "yyyy-MM-dd HH:mm:ss", 1 },
+    { "yyyy-MM-dd HH:mm", 60 }
+  };
+
+  Wt::WString text = Wt::WString::fromUTF8(boost::trim_copy(edit->text().toUTF8()));
+  if (text.empty()) return true;
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+    Wt::WDateTime dt = Wt::WDateTime::fromString(text, formats[i].format);
+    if (dt.isValid()) {
+      int64_t s = static_cast<int64_t>(dt.toTime_t());
+      *ns = end ? (s + formats[i].seconds) * 1000000000LL - 1 : s * 1000000000LL;
+      return true;
     }
   }
+  return false;
 }
 
 
-static void
-output_integer_values(const char *p, const char *e, stringstream &ss)
+namespace {
+
+struct scan_range {
+  size_t    file;
+  size_t    begin;
+  size_t    end;
+  size_t    scanned;
+  bool      done;
+  bool      cached;   // held by the message cache
+  std::deque<std::pair<long long, size_t> > matches; // timestamp, offset
+};
+
+struct scan_worker {
+  scan_worker(lsb_message_matcher *mm) : mm(mm)
+  {
+    lsb_init_heka_message(&m, 10);
+  }
+
+  ~scan_worker()
+  {
+    lsb_free_heka_message(&m);
+  }
+
+  lsb_message_matcher *mm; // shared, evaluating only reads the parsed tree
+  lsb_heka_message    m;
+};
+
+struct aggregate_worker {
+  aggregate_worker(lsb_message_matcher *mm) : scan(mm), total(0), messages(0) { }
+
+  scan_worker                           scan;
+  std::unordered_map<string, uint64_t>  groups;
+  std::map<int64_t, uint64_t>           minutes;
+  uint64_t                              total;
+  uint64_t                              messages;
+};
+
+/**
+ * The mapped input queue files and their ranges in scan priority order.
+ */
+struct queue_scan {
+  queue_scan() : budgeted(0) { }
+
+  std::vector<std::unique_ptr<hs::heka_scanner> > files;
+  std::vector<size_t>                             begins;   // time range start
+  std::vector<size_t>                             ends;     // checkpoint or time range limit
+  std::vector<hs::index_lookup>                   lookups;
+  std::vector<std::shared_ptr<const hs::message_block> > cached; // head of the queue
+  std::vector<scan_range>                         ranges;
+  uint64_t                                        budgeted; // bytes
+};
+
+}
+
+
+/**
+ * Splits the mapped queue files (from first on) into frame aligned ranges in
+ * scan priority order (newest first: the last range of the newest file first)
+ * stopping once the byte budget is covered. Indexed prefixes the index rules
+ * out are left out entirely; the span held by the message cache is split on
+ * its own.
+ *
+ * @return bool False if the byte budget cut the queue short
+ */
+static bool
+split_queue(queue_scan *qs, size_t first, bool oldest_first, uint64_t max_bytes)
 {
-  int acnt = 0;
-  long long ll = 0;
-  while (p && p < e) {
-    p = lsb_pb_read_varint(p, e, &ll);
-    if (p) {
-      if (acnt++) ss << ", ";
-      ss << ll;
+  static const size_t chunk_size = 32 * 1024 * 1024;
+  for (size_t f = first; f < qs->files.size(); ++f) {
+    const hs::heka_scanner &file = *qs->files[f];
+    const hs::index_lookup &ix = qs->lookups[f];
+    const size_t size = qs->ends[f];
+    vector<scan_range> fr;
+    size_t begin = max(qs->begins[f], ix.skip ? ix.indexed_bytes : 0);
+    // the span held by the message cache gets ranges of its own
+    const hs::message_block *b = qs->cached[f].get();
+    size_t ce = b ? min(b->end, size) : size;
+    size_t cb = b ? min(max(begin, b->begin), ce) : size;
+    while (begin < size) {
+      bool cached = begin >= cb && begin < ce;
+      size_t end;
+      if (cached) {
+        auto o = lower_bound(b->offsets.begin(), b->offsets.end(), begin + chunk_size);
+        end = o != b->offsets.end() ? min(*o, ce) : ce;
+      } else {
+        end = begin + chunk_size < size ? min(file.find_frame(begin + chunk_size), size)
+            : size;
+        if (begin < cb) end = min(end, cb);
+      }
+      scan_range r;
+      r.file = f;
+      r.begin = begin;
+      r.end = end;
+      r.scanned = 0;
+      r.done = false;
+      r.cached = cached;
+      fr.push_back(r);
+      begin = end;
+    }
+    if (!oldest_first) {
+      reverse(fr.begin(), fr.end());
+    }
+    for (auto it = fr.begin(); it != fr.end(); ++it) {
+      if (qs->budgeted >= max_bytes) return false;
+      // the indexed prefix only costs the candidate records
+      qs->budgeted += it->end - max(it->begin, min(it->end, ix.indexed_bytes));
+      qs->ranges.push_back(*it);
     }
   }
+  return true;
+}
+
+
+/**
+ * The index query of the expression narrowed to the time range of the scan.
+ */
+static hs::index_query
+window_query(const string &mms, const hs::scan_options &opts)
+{
+  hs::index_query q = hs::index_query::from_matcher(mms);
+  if (opts.min_ts > q.min_ts) q.min_ts = opts.min_ts;
+  if (opts.max_ts < q.max_ts) q.max_ts = opts.max_ts;
+  return q;
 }
 
+
+/**
+ * Maps the files of one queue up to its checkpoint, resolves the query against
+ * their indexes, takes the decoded head of the queue from the message cache
+ * and appends their ranges within the byte budget. When the
+ * query has a time range the files are bisected by their first timestamp and
+ * the first and last file of the range by frame, so a narrow window in a
+ * large queue only maps a few files and touches a few pages of each.
+ */
 static void
-output_double_values(const char *p, const char *e, stringstream &ss)
+open_queue(const hs::queue_index *index, hs::message_cache *recent, const fs::path &path,
+           unsigned queue, const hs::index_query &q, const hs::scan_options &opts,
+           queue_scan *qs, hs::scan_coverage *cov)
 {
-  int acnt = 0;
-  double d = 0;
-  while (p && p < e) {
-    memcpy(&d, p, sizeof(double));
-    if (acnt++) ss << ", ";
-    ss << d;
-    p += sizeof(double);
+  const char *name = hs::scan_options::queue_name(queue);
+  unsigned long long cp_file = ULLONG_MAX;
+  size_t cp_offset = 0;
+  bool cp = read_checkpoint(path, name, &cp_file, &cp_offset);
+  auto queue_files = list_queue(path / name, true, cp_file);
+
+  vector<unique_ptr<hs::heka_scanner> > files(queue_files.size()); // mapped on demand
+  vector<size_t> ends(queue_files.size());
+  vector<bool> failed(queue_files.size());
+  auto open_file = [&](size_t i) -> hs::heka_scanner * {
+    if (!files[i] && !failed[i]) {
+      unique_ptr<hs::heka_scanner> file(new hs::heka_scanner);
+      if (file->open(queue_files[i].second, opts.max_message_size)) {
+        ends[i] = file->size();
+        if (cp && queue_files[i].first == cp_file && cp_offset < ends[i]) {
+          ends[i] = cp_offset; // not checkpointed yet
+        }
+        files[i] = move(file);
+      } else {
+        failed[i] = true;
+      }
+    }
+    return files[i].get();
+  };
+
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  // number of files (oldest first) whose first message is at or before ts
+  auto files_before = [&](int64_t ts) {
+    size_t lo = 0, hi = queue_files.size();
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      hs::heka_scanner *file = open_file(mid);
+      bool before = false;
+      if (file) {
+        file->seek(0);
+        before = file->next(&m) && file->offset() < ends[mid] && m.timestamp <= ts;
+      }
+      if (before) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  };
+  const bool has_min = q.min_ts != numeric_limits<int64_t>::min();
+  const bool has_max = q.max_ts != numeric_limits<int64_t>::max();
+  size_t first = 0, last = queue_files.size();
+  if (has_min) {
+    first = files_before(q.min_ts);
+    if (first) --first; // the range starts inside it
+  }
+  if (has_max) {
+    last = max(first, files_before(q.max_ts));
+  }
+  cov->files_total += last - first;
+
+  size_t base = qs->files.size();
+  vector<fs::path> names;
+  for (size_t i = first; i < last; ++i) {
+    hs::heka_scanner *file = open_file(i);
+    if (!file) continue;
+    size_t begin = 0;
+    size_t end = ends[i];
+    if (has_min && i == first) {
+      begin = file->find_timestamp(q.min_ts, 0, end, &m);
+    }
+    if (has_max && i + 1 == last) {
+      end = file->find_timestamp(q.max_ts + 1, begin, end, &m);
+    }
+    cov->bytes_total += end - begin;
+    qs->files.push_back(move(files[i]));
+    qs->begins.push_back(begin);
+    qs->ends.push_back(end);
+    names.push_back(queue_files[i].second);
+    qs->cached.push_back(shared_ptr<const hs::message_block>());
+    if (i + 1 == queue_files.size()) { // the head of the queue
+      qs->cached.back() = recent->head(queue_files[i].second, *qs->files.back(), ends[i],
+                                       opts.max_message_size);
+    }
+  }
+  lsb_free_heka_message(&m);
+  if (!opts.oldest_first) {
+    reverse(qs->files.begin() + base, qs->files.end());
+    reverse(qs->begins.begin() + base, qs->begins.end());
+    reverse(qs->ends.begin() + base, qs->ends.end());
+    reverse(qs->cached.begin() + base, qs->cached.end());
+    reverse(names.begin(), names.end());
+  }
+
+  // only the input queue is indexed
+  if (queue != hs::scan_options::input_queue) index = nullptr;
+  qs->lookups.resize(qs->files.size());
+  for (size_t f = base; f < qs->files.size(); ++f) {
+    hs::index_lookup &ix = qs->lookups[f];
+    if (!index || !index->lookup(names[f - base], q, &ix)) {
+      ix = hs::index_lookup();
+    } else if (ix.skip && ix.indexed_bytes > qs->begins[f]) {
+      // covered by the index
+      cov->bytes += min(ix.indexed_bytes, qs->ends[f]) - qs->begins[f];
+    }
+  }
+  if (!split_queue(qs, base, opts.oldest_first, opts.max_bytes)) {
+    cov->budget_exhausted = true;
   }
 }
 
 
-static void
-output_fields(lsb_heka_message *m, Wt::WTreeNode *n)
+/**
+ * Evaluates the matcher over one range: only the records the index could not
+ * rule out within the indexed prefix, every message past it. A range held by
+ * the message cache only evaluates the decoded messages.
+ *
+ * @param backward Walk the range from its end, newest message first, so a
+ *                 range stopped early only costs the bytes behind its end
+ * @param matched Called with the offset and the message of each match,
+ *                returns true to stop the range
+ * @param interrupted Polled every 256 messages, returns true to stop the
+ *                    range
+ *
+ * @return size_t Number of bytes of the range covered
+ */
+template<class M, class I>
+static size_t
+scan_messages(const queue_scan &qs, const scan_range &r, scan_worker &w,
+              size_t max_message_size, bool backward, uint64_t *evaluated, M matched,
+              I interrupted)
 {
-  const char *p, *e;
-  for (int i = 0; i < m->fields_len; ++i) {
-    stringstream ss;
-    lsb_heka_field *hf = &m->fields[i];
-    ss << std::string(hf->name.s, hf->name.len) << " = ";
-    p = hf->value.s;
-    e = p + hf->value.len;
-    switch (hf->value_type) {
-    case LSB_PB_STRING:
-    case LSB_PB_BYTES:
-      output_string_values(p, e, ss);
-      break;
-    case LSB_PB_INTEGER:
-    case LSB_PB_BOOL:
-      output_integer_values(p, e, ss);
-      break;
-    case LSB_PB_DOUBLE:
-      output_double_values(p, e, ss);
-      break;
+  const hs::heka_scanner &file = *qs.files[r.file];
+  hs::heka_scanner scanner;
+  scanner.open(file.data(), file.size(), max_message_size);
+  bool stop = false;
+  uint64_t n = 0;
+
+  if (r.cached) {
+    const hs::message_block &b = *qs.cached[r.file];
+    size_t lo = lower_bound(b.offsets.begin(), b.offsets.end(), r.begin) - b.offsets.begin();
+    size_t hi = lower_bound(b.offsets.begin(), b.offsets.end(), r.end) - b.offsets.begin();
+    size_t covered = backward ? r.end : r.begin;
+    for (size_t k = 0; !stop && k < hi - lo; ++k) {
+      size_t i = backward ? hi - 1 - k : lo + k;
+      // evaluating only reads the message, the views are shared by the scans
+      lsb_heka_message *m = const_cast<lsb_heka_message *>(&b.messages[i]);
+      ++n;
+      if (lsb_eval_message_matcher(w.mm, m)) {
+        stop = matched(b.offsets[i], *m);
+      }
+      stop = stop || ((n & 0xff) == 0 && interrupted());
+      covered = backward ? b.offsets[i] : (i + 1 < hi ? b.offsets[i + 1] : r.end);
+    }
+    if (!stop) covered = backward ? r.begin : r.end;
+    if (evaluated) *evaluated += n;
+    return backward ? r.end - covered : covered - r.begin;
+  }
+
+  const hs::index_lookup &ix = qs.lookups[r.file];
+  if (backward) {
+    size_t covered = r.end;
+    size_t from = max(r.begin, ix.indexed_bytes);
+    if (from < r.end) {
+      scanner.seek(r.end);
+      while (!stop && scanner.prev(&w.m, from)) {
+        ++n;
+        if (lsb_eval_message_matcher(w.mm, &w.m)) {
+          stop = matched(scanner.offset(), w.m);
+        }
+        stop = stop || ((n & 0xff) == 0 && interrupted());
+      }
+      covered = scanner.position();
+    }
+    if (!stop && r.begin < ix.indexed_bytes) {
+      size_t to = min(r.end, ix.indexed_bytes);
+      auto c = lower_bound(ix.candidates.begin(), ix.candidates.end(), to);
+      while (!stop && c != ix.candidates.begin() && *(c - 1) >= r.begin) {
+        --c;
+        scanner.seek(*c);
+        if (scanner.next(&w.m) && scanner.offset() == *c) {
+          ++n;
+          if (lsb_eval_message_matcher(w.mm, &w.m)) {
+            stop = matched(*c, w.m);
+          }
+        }
+        covered = *c;
+        stop = stop || ((n & 0xff) == 0 && interrupted());
+      }
+      if (!stop) covered = r.begin;
+    }
+    if (evaluated) *evaluated += n;
+    return r.end - covered;
+  }
+
+  size_t covered = r.begin;
+  if (r.begin < ix.indexed_bytes) {
+    size_t to = min(r.end, ix.indexed_bytes);
+    auto c = lower_bound(ix.candidates.begin(), ix.candidates.end(), r.begin);
+    for (; !stop && c != ix.candidates.end() && *c < to; ++c) {
+      scanner.seek(*c);
+      if (scanner.next(&w.m) && scanner.offset() == *c) {
+        ++n;
+        if (lsb_eval_message_matcher(w.mm, &w.m)) {
+          stop = matched(*c, w.m);
+        }
+      }
+      covered = *c;
+      stop = stop || ((n & 0xff) == 0 && interrupted());
+    }
+    if (!stop) covered = to;
+  }
+  if (!stop && covered < r.end) {
+    scanner.seek(covered);
+    while (!stop && scanner.next(&w.m) && scanner.offset() < r.end) {
+      ++n;
+      if (lsb_eval_message_matcher(w.mm, &w.m)) {
+        stop = matched(scanner.offset(), w.m);
+      }
+      stop = stop || ((n & 0xff) == 0 && interrupted());
     }
-    n->addChildNode(new Wt::WTreeNode(Wt::WString(ss.str(), Wt::CharEncoding::UTF8)));
+    covered = min(scanner.position(), r.end);
+  }
+  if (evaluated) *evaluated += n;
+  return covered - r.begin;
+}
+
+
+/**
+ * Adds the scanned ranges to the coverage.
+ */
+static void
+close_coverage(const queue_scan &qs, hs::scan_coverage *cov)
+{
+  vector<bool> touched(qs.files.size());
+  for (size_t f = 0; f < qs.files.size(); ++f) {
+    touched[f] = qs.lookups[f].skip && qs.lookups[f].indexed_bytes > 0;
+  }
+  for (auto it = qs.ranges.begin(); it != qs.ranges.end(); ++it) {
+    cov->bytes += it->scanned;
+    if (it->scanned) touched[it->file] = true;
   }
+  cov->files += count(touched.begin(), touched.end(), true);
 }
 
 
+namespace {
+
+struct timeline_entry {
+  long long timestamp;
+  unsigned  queue;
+  string    raw;
+};
+
+}
+
+
+/**
+ * Runs the matcher over the files of one queue on the scan pool. The files
+ * are split into frame aligned ranges, the pool participants evaluate the one
+ * cached matcher with their own decode scratch and every range keeps the
+ * max_matches matches nearest to the preferred end of the queue (newest
+ * first, the ranges are walked backward from their end so they stop as soon
+ * as they have enough matches). The selection follows the scan priority;
+ * ranges that can no longer contribute are skipped and the byte/time budget
+ * bounds the whole run. Where the queue index covers a file only the
+ * candidate records it returns are decoded. A cancel request stops the scan
+ * keeping the matches found so far.
+ *
+ * @param timeline Receives the selection in timestamp order
+ */
 static void
-output_fields(lsb_heka_message *m, stringstream &ss)
+sample_queue(hs::scan_pool *pool, const hs::queue_index *index, hs::message_cache *recent,
+             const fs::path &path, unsigned queue, const string &mms, lsb_message_matcher *mm,
+             const hs::scan_options &opts, size_t max_matches, chrono::steady_clock::time_point deadline,
+             hs::scan_progress *progress, vector<timeline_entry> *timeline,
+             hs::scan_coverage *cov)
 {
-  const char *p, *e;
-  for (int i = 0; i < m->fields_len; ++i) {
-    lsb_heka_field *hf = &m->fields[i];
-    ss << "\n" << std::string(hf->name.s, hf->name.len) << " = ";
-    p = hf->value.s;
-    e = p + hf->value.len;
-    switch (hf->value_type) {
-    case LSB_PB_STRING:
-    case LSB_PB_BYTES:
-      output_string_values(p, e, ss);
-      break;
-    case LSB_PB_INTEGER:
-    case LSB_PB_BOOL:
-      output_integer_values(p, e, ss);
-      break;
-    case LSB_PB_DOUBLE:
-      output_double_values(p, e, ss);
-      break;
+  const bool oldest_first = opts.oldest_first;
+  queue_scan qs;
+  uint64_t indexed = cov->bytes;
+  open_queue(index, recent, path, queue, window_query(mms, opts), opts, &qs, cov);
+  progress->bytes += cov->bytes - indexed;
+
+  vector<scan_range> &ranges = qs.ranges;
+  mutex cutoff_mutex;
+  atomic<size_t> cutoff(ranges.size()); // ranges past it cannot contribute
+  atomic<bool> timed_out(false);
+  vector<unique_ptr<scan_worker> > workers(pool->slots());
+
+  pool->run(ranges.size(), [&](size_t i, unsigned slot) {
+    scan_range &r = ranges[i];
+    if (i > cutoff || timed_out || progress->cancel) return;
+
+    if (!workers[slot]) workers[slot].reset(new scan_worker(mm));
+    scan_worker &w = *workers[slot];
+
+    r.scanned = scan_messages(qs, r, w, opts.max_message_size, !oldest_first, nullptr,
+                              [&](size_t offset, const lsb_heka_message &m) {
+                                if (m.timestamp < opts.min_ts || m.timestamp > opts.max_ts) {
+                                  return false; // the files are only roughly in order
+                                }
+                                ++progress->matches;
+                                if (oldest_first) {
+                                  r.matches.push_back(make_pair(m.timestamp, offset));
+                                } else {
+                                  r.matches.push_front(make_pair(m.timestamp, offset));
+                                }
+                                return r.matches.size() == max_matches;
+                              },
+                              [&]() {
+                                if (i > cutoff || progress->cancel) return true;
+                                if (chrono::steady_clock::now() > deadline) {
+                                  timed_out = true;
+                                  return true;
+                                }
+                                return false;
+                              });
+    progress->bytes += r.scanned;
+
+    {
+      lock_guard<mutex> lock(cutoff_mutex);
+      r.done = true;
+      size_t found = 0;
+      for (size_t j = 0; j < ranges.size() && ranges[j].done; ++j) {
+        found += ranges[j].matches.size();
+        if (found >= max_matches) {
+          if (j < cutoff) cutoff = j;
+          break;
+        }
+      }
+    }
+    if (progress->changed) progress->changed();
+  });
+
+  vector<pair<long long, pair<size_t, size_t> > > selected; // timestamp, file, offset
+  for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+    for (size_t k = 0; k < it->matches.size() && selected.size() < max_matches; ++k) {
+      size_t idx = oldest_first ? k : it->matches.size() - 1 - k;
+      selected.push_back(make_pair(it->matches[idx].first,
+                                   make_pair(it->file, it->matches[idx].second)));
+    }
+  }
+  close_coverage(qs, cov);
+  if (timed_out) cov->budget_exhausted = true;
+  sort(selected.begin(), selected.end());
+
+  // copied out, the mappings are released with the scanners
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  for (auto it = selected.begin(); it != selected.end(); ++it) {
+    hs::heka_scanner &file = *qs.files[it->second.first];
+    file.seek(it->second.second);
+    if (file.next(&m)) {
+      timeline_entry e = { it->first, queue, string(m.raw.s, m.raw.len) };
+      timeline->push_back(move(e));
     }
   }
+  lsb_free_heka_message(&m);
 }
 
 
+/**
+ * K-way merge of the per queue selections (each in timestamp order) keeping
+ * the max_matches messages nearest to the preferred end of the timeline.
+ */
 static void
-output_message(lsb_heka_message *m, stringstream &ss)
+merge_timelines(vector<vector<timeline_entry> > &timelines, size_t max_matches,
+                bool oldest_first, hs::scan_result *result)
 {
-  ss << "Uuid = ";
-  for (unsigned i = 0; i < LSB_UUID_SIZE; ++i) {
-    ss << std::setfill('0') << std::setw(2) << std::hex << (unsigned int)((unsigned char)m->uuid.s[i]);
+  typedef pair<long long, size_t> head; // timestamp, timeline
+  priority_queue<head, vector<head>, greater<head> > heads;
+  vector<size_t> pos(timelines.size());
+  for (size_t t = 0; t < timelines.size(); ++t) {
+    if (!timelines[t].empty()) heads.push(make_pair(timelines[t][0].timestamp, t));
+  }
+
+  vector<timeline_entry> merged;
+  while (!heads.empty()) {
+    size_t t = heads.top().second;
+    heads.pop();
+    merged.push_back(move(timelines[t][pos[t]]));
+    if (++pos[t] < timelines[t].size()) {
+      heads.push(make_pair(timelines[t][pos[t]].timestamp, t));
+    }
   }
 
-  char ts[80];
-  time_t t = m->timestamp / 1000000000;
-  struct tm *tms = gmtime(&t);
-  strftime(ts, sizeof ts, "%F %X", tms);
-  ss << "\nTimestamp = " << ts;
-  ss << "\nType = " << std::string(m->type.s, m->type.len);
-  ss << "\nLogger = " << std::string(m->logger.s, m->logger.len);
-  ss << "\nSeverity = " << std::dec << m->severity;
-  ss << "\nPayload = " << std::string(m->payload.s, m->payload.len);
-  ss << "\nEnvVersion = " << std::string(m->env_version.s, m->env_version.len);
-  ss << "\nPid = ";
-  if (m->pid != INT_MIN) {
-    ss << std::dec << m->pid;
+  size_t first = 0, last = merged.size();
+  if (merged.size() > max_matches) {
+    if (oldest_first) {
+      last = max_matches;
+    } else {
+      first = merged.size() - max_matches;
+    }
   }
-  ss << "\nHostname = " << std::string(m->hostname.s, m->hostname.len);
-  if (m->fields_len) {
-    ss << "\nFields";
-    output_fields(m, ss);
+  for (size_t i = first; i < last; ++i) {
+    result->messages.push_back(move(merged[i].raw));
+    result->queues.push_back(merged[i].queue);
   }
 }
 
 
-static ssize_t
-read_file(FILE *fh, lsb_input_buffer *ib)
+/**
+ * Samples the selected queues one after the other (the byte budget applies
+ * to each queue, the time budget to the whole run) and merges them into a
+ * single timeline. Runs off the session thread: progress is published through
+ * the scan_progress counters.
+ */
+static void
+scan_queue(hs::scan_pool *pool, const hs::queue_index *index, hs::message_cache *recent,
+           const fs::path &path, const string &mms, lsb_message_matcher *mm,
+           const hs::scan_options &opts,
+           size_t max_matches, hs::scan_progress *progress, hs::scan_result *result)
 {
-  size_t need;
-  if (ib->msglen) {
-    need = ib->msglen + (unsigned char)ib->buf[1] + LSB_HDR_FRAME_SIZE
-        - ib->readpos; // read exactly to the end of the message
-                       // we want one message per buffer since we are saving them off
-  } else {
-    need = 16; // read enough to grab the header but not part of the next msg
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(opts.max_ms);
+  *result = hs::scan_result();
+  if (max_matches == 0) {
+    return;
   }
 
-  if (lsb_expand_input_buffer(ib, need)) {
-    return -1;
-  }
-  size_t nread = fread(ib->buf + ib->readpos,
-                       1,
-                       need,
-                       fh);
-  if (nread > 0) {
-    ib->readpos += nread;
+  vector<vector<timeline_entry> > timelines;
+  for (unsigned q = hs::scan_options::input_queue; q <= hs::scan_options::analysis_queue; q <<= 1) {
+    if (!(opts.queues & q) || progress->cancel) continue;
+    timelines.push_back(vector<timeline_entry>());
+    sample_queue(pool, index, recent, path, q, mms, mm, opts, max_matches, deadline, progress,
+                 &timelines.back(), &result->coverage);
   }
-  return nread;
+  merge_timelines(timelines, max_matches, opts.oldest_first, result);
+  result->coverage.cancelled = progress->cancel;
 }
 
 
 static string
-get_file_number(const boost::filesystem::path &path) // todo add support for the analysis queue
+group_key(const lsb_heka_message &m, hs::scan_aggregate::group g)
 {
-  lua_State *L = luaL_newstate();
-  if (!L) {return "0";}
+  switch (g) {
+  case hs::scan_aggregate::group_type:
+    return string(m.type.s, m.type.len);
+  case hs::scan_aggregate::group_logger:
+    return string(m.logger.s, m.logger.len);
+  case hs::scan_aggregate::group_hostname:
+    return string(m.hostname.s, m.hostname.len);
+  default:
+    return string();
+  }
+}
 
-  lua_pushvalue(L, LUA_GLOBALSINDEX);
-  lua_setglobal(L, "_G");
 
-  string cpfn((path / "hindsight.cp").string());
-  int ret = luaL_dofile(L, cpfn.c_str());
-  if (ret) {
-    Wt::log("error") << "could not parse the checkpoint file: " << cpfn;
-    lua_close(L);
-    return "0";
+/**
+ * Counts the matching messages of the selected queues (within the budget) on
+ * the scan pool; every participant keeps its own group and per minute
+ * counts which are merged at the end. No message is copied out.
+ *
+ * @param since Only messages at or after this timestamp (ns) are counted
+ */
+static void
+aggregate_queue(hs::scan_pool *pool, const hs::queue_index *index, hs::message_cache *recent,
+                const fs::path &path, const string &mms, lsb_message_matcher *mm,
+                const hs::scan_options &opts, hs::scan_aggregate::group g, int64_t since,
+                hs::scan_progress *progress, hs::scan_aggregate *result)
+{
+  static const size_t max_groups = 100000; // per participant
+  auto started = chrono::steady_clock::now();
+  auto deadline = started + chrono::milliseconds(opts.max_ms);
+
+  *result = hs::scan_aggregate();
+  result->group_by = g;
+  hs::scan_coverage *cov = &result->coverage;
+  hs::index_query q = window_query(mms, opts);
+  if (since > q.min_ts) q.min_ts = since;
+  queue_scan qs;
+  for (unsigned queue = hs::scan_options::input_queue; queue <= hs::scan_options::analysis_queue;
+       queue <<= 1) {
+    if (opts.queues & queue) {
+      qs.budgeted = 0; // the byte budget applies to each queue
+      open_queue(index, recent, path, queue, q, opts, &qs, cov);
+    }
   }
-  lua_getglobal(L, "input");
-  string cp(lua_tostring(L, -1));
-  lua_pop(L, 1);
-  lua_close(L);
-
-  return cp.substr(0, cp.find_first_of(":"));
+  progress->bytes = cov->bytes;
+
+  atomic<bool> timed_out(false);
+  vector<unique_ptr<aggregate_worker> > workers(pool->slots());
+  pool->run(qs.ranges.size(), [&](size_t i, unsigned slot) {
+    scan_range &r = qs.ranges[i];
+    if (timed_out || progress->cancel) return;
+
+    if (!workers[slot]) workers[slot].reset(new aggregate_worker(mm));
+    aggregate_worker &w = *workers[slot];
+
+    r.scanned = scan_messages(qs, r, w.scan, opts.max_message_size, false, &w.messages,
+                              [&](size_t, const lsb_heka_message &m) {
+                                if (m.timestamp < q.min_ts || m.timestamp > q.max_ts) return false;
+                                ++w.total;
+                                ++progress->matches;
+                                ++w.minutes[m.timestamp / 1000000000 / 60 * 60];
+                                if (g != hs::scan_aggregate::group_none) {
+                                  string key = group_key(m, g);
+                                  auto it = w.groups.find(key);
+                                  if (it != w.groups.end()) {
+                                    ++it->second;
+                                  } else if (w.groups.size() < max_groups) {
+                                    w.groups[key] = 1;
+                                  } else {
+                                    ++w.groups[hs::scan_aggregate::other_group];
+                                  }
+                                }
+                                return false;
+                              },
+                              [&]() {
+                                if (progress->cancel) return true;
+                                if (chrono::steady_clock::now() > deadline) {
+                                  timed_out = true;
+                                  return true;
+                                }
+                                return false;
+                              });
+    progress->bytes += r.scanned;
+    if (progress->changed) progress->changed();
+  });
+
+  unordered_map<string, uint64_t> groups;
+  map<int64_t, uint64_t> minutes;
+  for (auto it = workers.begin(); it != workers.end(); ++it) {
+    if (!*it) continue;
+    aggregate_worker &w = **it;
+    result->total += w.total;
+    result->messages += w.messages;
+    for (auto m = w.minutes.begin(); m != w.minutes.end(); ++m) {
+      minutes[m->first] += m->second;
+    }
+    for (auto k = w.groups.begin(); k != w.groups.end(); ++k) {
+      groups[k->first] += k->second;
+    }
+  }
+  result->groups = groups.size();
+  result->top.assign(groups.begin(), groups.end());
+  size_t n = min(result->top.size(), hs::scan_aggregate::top_groups);
+  partial_sort(result->top.begin(), result->top.begin() + n, result->top.end(),
+               [](const pair<string, uint64_t> &a, const pair<string, uint64_t> &b) {
+                 return a.second > b.second || (a.second == b.second && a.first < b.first);
+               });
+  result->top.resize(n);
+  result->per_minute.assign(minutes.begin(), minutes.end());
+
+  close_coverage(qs, cov);
+  if (timed_out) cov->budget_exhausted = true;
+  cov->cancelled = progress->cancel;
+  result->elapsed_ms = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - started).count();
 }
 
 
@@ -238,7 +867,8 @@ static size_t get_max_cfg()
 
 lua_State* hs::validate_cfg(const std::string &cfg,
                             const std::string &user,
-                            lsb_message_matcher **mm,
+                            matcher_cache *matchers,
+                            compiled_matcher *mm,
                             std::string *err_msg)
 {
   static size_t max_cfg = 0;
@@ -249,7 +879,7 @@ lua_State* hs::validate_cfg(const std::string &cfg,
   int t = 0;
   int v = 0;
   int ret = 0;
-  *mm = NULL;
+  compiled_matcher cm;
 
   if (!max_cfg) {
     max_cfg =  get_max_cfg();
@@ -296,8 +926,8 @@ lua_State* hs::validate_cfg(const std::string &cfg,
     err << "a message matcher must be specified";
     goto error;
   }
-  *mm = lsb_create_message_matcher(mms);
-  if (!*mm) {
+  cm = matchers->get(mms);
+  if (!cm) {
     err << "invalid message matcher: " << mms;
     goto error;
   }
@@ -323,134 +953,309 @@ lua_State* hs::validate_cfg(const std::string &cfg,
 error:
   if (!err.str().empty()) {
     lua_close(L);
-    lsb_destroy_message_matcher(*mm);
-    *mm = NULL;
     if (err_msg) {
       *err_msg = err.str();
     }
     return NULL;
   }
+  if (mm) *mm = cm;
   return L;
 }
 
 
-size_t hs::run_matcher(const boost::filesystem::path &path,
-                       const std::string &cfg,
-                       const std::string &user,
-                       Wt::WContainerWidget *c,
-                       struct hs::input_msg *msgs,
-                       size_t msgs_size,
-                       string *err_msg)
+bool hs::run_matcher(scan_job *job,
+                     matcher_cache *matchers,
+                     const boost::filesystem::path &path,
+                     const std::string &cfg,
+                     const std::string &user,
+                     size_t max_message_size,
+                     unsigned queues,
+                     size_t max_matches,
+                     const scan_job::completion &cb,
+                     string *err_msg)
 {
-  Wt::WTree *tree = new Wt::WTree(c);
-  tree->setSelectionMode(Wt::SingleSelection);
-  Wt::WTreeNode *root = new Wt::WTreeNode(hs::tr("messages"));
-  root->setStyleClass("tree_results");
-  tree->setTreeRoot(root);
-  root->label()->setTextFormat(Wt::PlainText);
-  root->setLoadPolicy(Wt::WTreeNode::NextLevelLoading);
-
-  lsb_message_matcher *mm = NULL;
-  lua_State *L = validate_cfg(cfg, user, &mm, err_msg);
+  compiled_matcher mm;
+  lua_State *L = validate_cfg(cfg, user, matchers, &mm, err_msg);
   if (!L) {
-    return 0;
+    return false;
   }
+  lua_getglobal(L, "message_matcher");
+  string mms(lua_tostring(L, -1));
   lua_close(L);
 
-  fs::path fn = path / "input" / (get_file_number(path) + ".log");
-  FILE *fh = fopen(fn.string().c_str(), "rb");
-  if (!fh) {
-    stringstream ss;
-    ss << "could not open the log: " << fn;
-    Wt::log("error") << ss.str();
-    lsb_destroy_message_matcher(mm);
-    return 0;
-  }
-
-  size_t cnt = 0;
-  ssize_t bytes_read = 1;
-  size_t discarded_bytes = 0;
-  while (cnt < msgs_size && bytes_read != 0) {
-    if (lsb_find_heka_message(&msgs[cnt].m, &msgs[cnt].b, true,
-                              &discarded_bytes, NULL)) {
-      if (lsb_eval_message_matcher(mm, &msgs[cnt].m)) {
-        output_message(&msgs[cnt++].m, root);
-      }
-    } else {
-      bytes_read = read_file(fh, &msgs[cnt].b);
-    }
+  scan_options opts = scan_options::from_config(max_message_size);
+  opts.queues = queues;
+  if (!job->start(path, mms, mm, opts, max_matches, cb)) {
+    *err_msg = Wt::WString::tr("job_limit").toUTF8();
+    return false;
   }
-  fclose(fh);
-  lsb_destroy_message_matcher(mm);
-  root->expand();
-  return cnt;
+  return true;
 }
 
 
-void hs::output_message(lsb_heka_message *m, Wt::WTreeNode *root)
+Wt::WString hs::coverage_message(const scan_coverage &cov)
 {
-  if (!m || !root) {return;}
+  const double mb = 1024 * 1024;
+  const char *id = "scan_coverage";
+  if (cov.cancelled) {
+    id = "scan_coverage_cancelled";
+  } else if (cov.budget_exhausted) {
+    id = "scan_coverage_partial";
+  }
+  Wt::WString msg = Wt::WString::tr(id);
+  return msg.arg(static_cast<int>(cov.files))
+      .arg(static_cast<int>(cov.files_total))
+      .arg(round(cov.bytes / mb * 10) / 10)
+      .arg(round(cov.bytes_total / mb * 10) / 10);
+}
+
 
-  stringstream ss;
-  ss << "Uuid = ";
-  for (unsigned i = 0; i < LSB_UUID_SIZE; ++i) {
-    ss << std::setfill('0') << std::setw(2) << std::hex << (unsigned int)((unsigned char)m->uuid.s[i]);
+void hs::show_matches(const scan_result &r, Wt::WContainerWidget *parent)
+{
+  if (r.messages.empty()) {
+    Wt::WText *t = new Wt::WText(Wt::WString::tr("no_matches"), parent);
+    t->setStyleClass("result_error");
   }
-  Wt::WTreeNode *n = new Wt::WTreeNode(ss.str());
-  n->setLoadPolicy(Wt::WTreeNode::NextLevelLoading);
+  Wt::WText *t = new Wt::WText(coverage_message(r.coverage), parent);
+  t->setStyleClass("scan_coverage");
+}
+
+
+Wt::WTreeNode* hs::output_message(lsb_heka_message *m, Wt::WTreeNode *root)
+{
+  if (!m || !root) {return NULL;}
+
+  Wt::WTreeNode *n = new message_node(string(m->raw.s, m->raw.len));
   root->addChildNode(n);
-  ss.str("");
+  return n;
+}
 
-  char ts[80];
-  time_t t = m->timestamp / 1000000000;
-  struct tm *tms = gmtime(&t);
-  strftime(ts, sizeof ts, "%F %X", tms);
-  ss << "Timestamp = " << ts;
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
 
-  ss.str("");
-  ss << "Type = " << std::string(m->type.s, m->type.len);
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
+vector<pair<fs::path, size_t> >
+hs::checkpointed_files(const boost::filesystem::path &path, unsigned queue)
+{
+  const char *name = scan_options::queue_name(queue);
+  unsigned long long cp_file = ULLONG_MAX;
+  size_t cp_offset = 0;
+  bool cp = read_checkpoint(path, name, &cp_file, &cp_offset);
+  auto queue_files = list_queue(path / name, true, cp_file);
+
+  vector<pair<fs::path, size_t> > files;
+  for (auto it = queue_files.begin(); it != queue_files.end(); ++it) {
+    size_t end = cp && it->first == cp_file ? cp_offset : SIZE_MAX;
+    files.push_back(make_pair(it->second, end));
+  }
+  return files;
+}
 
-  ss.str("");
-  ss << "Logger = " << std::string(m->logger.s, m->logger.len);
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
 
-  ss.str("");
-  ss << "Severity = " << std::dec << m->severity;
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
+hs::scan_options hs::scan_options::from_config(size_t max_message_size)
+{
+  Wt::WApplication *app = Wt::WApplication::instance();
+  scan_options opts;
+  string val;
+  opts.max_bytes = 1024ULL * 1024 * 1024;
+  if (app->readConfigurationProperty("matcher_scan_mb", val)) {
+    opts.max_bytes = boost::lexical_cast<uint64_t>(val) * 1024 * 1024;
+  }
+  opts.max_ms = 3000;
+  if (app->readConfigurationProperty("matcher_scan_ms", val)) {
+    opts.max_ms = boost::lexical_cast<int>(val);
+  }
+  opts.oldest_first = app->readConfigurationProperty("matcher_scan_order", val)
+      && val == "oldest";
+  opts.max_message_size = max_message_size;
+  return opts;
+}
+
+
+const char* hs::scan_options::queue_name(unsigned q)
+{
+  return q == analysis_queue ? "analysis" : "input";
+}
+
+
+Wt::WComboBox* hs::queue_selector(Wt::WContainerWidget *c)
+{
+  Wt::WComboBox *selector = new Wt::WComboBox(c);
+  selector->addItem(Wt::WString::tr("queue_input"));
+  selector->addItem(Wt::WString::tr("queue_analysis"));
+  selector->addItem(Wt::WString::tr("queue_merged"));
+  return selector;
+}
+
+
+Wt::WSpinBox* hs::sample_size_selector(Wt::WContainerWidget *c)
+{
+  int max = 5000;
+  string val;
+  if (Wt::WApplication::instance()->readConfigurationProperty("matcher_max_samples", val)) {
+    max = boost::lexical_cast<int>(val);
+  }
+  Wt::WSpinBox *selector = new Wt::WSpinBox(c);
+  selector->setRange(1, max);
+  selector->setValue(5);
+  selector->setToolTip(Wt::WString::tr("sample_size"));
+  return selector;
+}
+
+
+unsigned hs::selected_queues(const Wt::WComboBox *selector)
+{
+  switch (selector->currentIndex()) {
+  case 1:
+    return scan_options::analysis_queue;
+  case 2:
+    return scan_options::input_queue | scan_options::analysis_queue;
+  default:
+    return scan_options::input_queue;
+  }
+}
+
+
+hs::scan_job::scan_job(const services *svc, Wt::WContainerWidget *parent) :
+    Wt::WContainerWidget(parent),
+    m_services(svc),
+    m_id(-1)
+{
+  setStyleClass("scan_job");
+  m_progress = new Wt::WText(this);
+  m_cancel = new Wt::WPushButton(tr("cancel"), this);
+  m_cancel->clicked().connect(this, &scan_job::cancel);
+  hide();
+}
+
+
+hs::scan_job::~scan_job()
+{
+  if (m_id >= 0) {
+    m_services->jobs->release(m_id);
+  }
+}
+
+
+bool hs::scan_job::start(const boost::filesystem::path &path, const std::string &mms,
+                         const compiled_matcher &mm, const scan_options &opts,
+                         size_t max_matches, const completion &cb)
+{
+  // the work only touches server wide objects and its own result
+  auto result = make_shared<scan_result>();
+  scan_pool *pool = m_services->pool;
+  const queue_index *index = m_services->index;
+  message_cache *recent = m_services->recent;
+  return submit([=](scan_progress *p) {
+                  scan_queue(pool, index, recent, path, mms, mm.get(), opts, max_matches, p,
+                             result.get());
+                },
+                [=]() { cb(result); });
+}
+
+
+bool hs::scan_job::start(const boost::filesystem::path &path, const std::string &mms,
+                         const compiled_matcher &mm, const scan_options &opts,
+                         scan_aggregate::group g, int64_t since,
+                         const std::function<void(const scan_aggregate &r)> &cb)
+{
+  auto result = make_shared<scan_aggregate>();
+  scan_pool *pool = m_services->pool;
+  const queue_index *index = m_services->index;
+  message_cache *recent = m_services->recent;
+  return submit([=](scan_progress *p) {
+                  aggregate_queue(pool, index, recent, path, mms, mm.get(), opts, g, since, p,
+                                  result.get());
+                },
+                [=]() { cb(*result); });
+}
+
+
+bool hs::scan_job::start(const boost::filesystem::path &path, const std::string &mms,
+                         matcher_cache *matchers, const scan_options &opts,
+                         const std::shared_ptr<const scan_result> &corpus,
+                         size_t corpus_size,
+                         const std::function<void(const matcher_explain &r)> &cb)
+{
+  auto result = make_shared<matcher_explain>();
+  result->corpus = corpus;
+  compiled_matcher all = corpus ? compiled_matcher() : matchers->get("TRUE");
+  scan_pool *pool = m_services->pool;
+  const queue_index *index = m_services->index;
+  message_cache *recent = m_services->recent;
+  return submit([=](scan_progress *p) {
+                  if (!result->corpus) {
+                    auto sampled = make_shared<scan_result>();
+                    scan_queue(pool, index, recent, path, "TRUE", all.get(), opts, corpus_size,
+                               p, sampled.get());
+                    result->corpus = sampled;
+                  }
+                  explain_matcher(matchers, mms, p, result.get());
+                },
+                [=]() { cb(*result); });
+}
+
+
+bool hs::scan_job::submit(const scan_jobs::work &w, const std::function<void()> &cb)
+{
+  if (m_id >= 0) {
+    m_services->jobs->release(m_id);
+    m_id = -1;
+  }
 
-  ss.str("");
-  ss << "Payload = " << std::string(m->payload.s, m->payload.len);
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
+  m_id = m_services->jobs->submit(Wt::WApplication::instance()->sessionId(), w,
+                        [this](const scan_progress &p, bool done) {
+                          update(p, done);
+                        });
+  if (m_id < 0) {
+    hide();
+    return false;
+  }
+  m_cb = cb;
+  m_progress->setText(Wt::WString::tr("scan_progress").arg(0).arg(0));
+  m_cancel->setEnabled(true);
+  show();
+  return true;
+}
 
-  ss.str("");
-  ss << "EnvVersion = " << std::string(m->env_version.s, m->env_version.len);
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
 
-  ss.str("");
-  ss << "Pid = ";
-  if (m->pid != INT_MIN) {
-    ss << std::dec << m->pid;
+void hs::scan_job::update(const scan_progress &p, bool done)
+{
+  const double mb = 1024 * 1024;
+  m_progress->setText(Wt::WString::tr("scan_progress")
+                      .arg(round(p.bytes / mb * 10) / 10)
+                      .arg(static_cast<int>(p.matches)));
+  if (done) {
+    m_id = -1;
+    hide();
+    std::function<void()> cb;
+    cb.swap(m_cb);
+    cb();
   }
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
+  Wt::WApplication::instance()->triggerUpdate();
+}
 
-  ss.str("");
-  ss << "Hostname = " << std::string(m->hostname.s, m->hostname.len);
-  n->addChildNode(new Wt::WTreeNode(ss.str()));
 
-  if (m->fields_len) {
-    Wt::WTreeNode *f = new Wt::WTreeNode(hs::tr("fields"));
-    f->setLoadPolicy(Wt::WTreeNode::NextLevelLoading);
-    output_fields(m, f);
-    n->addChildNode(f);
+void hs::scan_job::cancel()
+{
+  if (m_id >= 0) {
+    m_services->jobs->cancel(m_id);
+    m_cancel->setEnabled(false);
   }
 }
 
 
-hs::matcher::matcher(const hindsight_cfg *hs_cfg) :
-    m_hs_cfg(hs_cfg)
+hs::matcher::matcher(const services *svc) :
+    m_services(svc),
+    m_hs_cfg(svc->cfg),
+    m_corpus_queues(0),
+    m_tail(svc->watcher),
+    m_tail_limit(200),
+    m_tail_matches(0),
+    m_tail_root(nullptr)
 {
+  string val;
+  if (Wt::WApplication::instance()->readConfigurationProperty("matcher_tail_messages", val)) {
+    m_tail_limit = boost::lexical_cast<size_t>(val);
+  }
+
   Wt::WContainerWidget *container = new Wt::WContainerWidget(this);
   container->setStyleClass("message_matcher");
 
@@ -462,61 +1267,370 @@ hs::matcher::matcher(const hindsight_cfg *hs_cfg) :
   m_mms->setText("TRUE");
 
   new Wt::WBreak(container);
+  m_mode = new Wt::WComboBox(container);
+  m_mode->addItem(tr("matcher_samples"));
+  m_mode->addItem(tr("matcher_count"));
+  m_mode->addItem(tr("matcher_count_type"));
+  m_mode->addItem(tr("matcher_count_logger"));
+  m_mode->addItem(tr("matcher_count_hostname"));
+  m_mode->addItem(tr("matcher_explain"));
+  m_mode->activated().connect(this, &matcher::mode_changed);
+
+  m_window = new Wt::WComboBox(container);
+  for (size_t i = 0; i < sizeof(g_windows) / sizeof(g_windows[0]); ++i) {
+    m_window->addItem(tr(g_windows[i].id));
+  }
+  m_window->setCurrentIndex(2);
+  m_window->hide();
+  m_from = new Wt::WLineEdit(container);
+  m_from->setPlaceholderText(tr("time_from"));
+  m_to = new Wt::WLineEdit(container);
+  m_to->setPlaceholderText(tr("time_to"));
+
+  m_queues = queue_selector(container);
+  m_samples = sample_size_selector(container);
+
   Wt::WPushButton *button = new Wt::WPushButton(tr("run_matcher"), container);
   button->clicked().connect(this, &matcher::run_matcher);
+  m_follow = new Wt::WPushButton(tr("follow"), container);
+  m_follow->clicked().connect(this, &matcher::toggle_follow);
+
+  m_job = new scan_job(svc, container);
+
+  new Wt::WBreak(container);
+  m_export_format = new Wt::WComboBox(container);
+  m_export_format->addItem(tr("export_ndjson"));
+  m_export_format->addItem(tr("export_heka"));
+  m_export_window = new Wt::WComboBox(container);
+  for (size_t i = 0; i < sizeof(g_windows) / sizeof(g_windows[0]); ++i) {
+    m_export_window->addItem(tr(g_windows[i].id));
+  }
+  button = new Wt::WPushButton(tr("export"), container);
+  button->clicked().connect(this, &matcher::prepare_export);
+  m_export = new message_export(this);
+  m_download = new Wt::WAnchor(Wt::WLink(m_export), tr("export_download"), container);
+  m_download->hide();
 
   new Wt::WBreak(container);
   new Wt::WBreak(container);
-  m_result = new Wt::WText(container);
-  m_result->setTextFormat(Wt::PlainText);
+  m_result = new Wt::WContainerWidget(container);
+  m_browser = new message_browser(container);
+  m_tail_status = new Wt::WText(container);
+  m_tail_status->setStyleClass("scan_coverage");
+  m_tail_view = new Wt::WContainerWidget(container);
+  m_tail_view->setStyleClass("tail_view");
+}
+
 
-  lsb_init_input_buffer(&m_im.b, hs_cfg->m_max_message_size);
-  lsb_init_heka_message(&m_im.m, 10);
+void hs::matcher::prepare_export()
+{
+  compiled_matcher mm = m_services->matchers->get(m_mms->text().toUTF8());
+  if (!mm) {
+    m_download->hide();
+    m_result->clear();
+    new Wt::WText("invalid message matcher", m_result);
+    return;
+  }
+  message_export::settings s;
+  s.path = m_hs_cfg->m_hs_output;
+  s.mm = mm;
+  s.queues = selected_queues(m_queues);
+  int64_t window = g_windows[m_export_window->currentIndex()].seconds;
+  if (window) {
+    s.since = (static_cast<int64_t>(time(nullptr)) - window) * 1000000000LL;
+  }
+  s.max_message_size = m_hs_cfg->m_max_message_size;
+  s.fmt = m_export_format->currentIndex() == 0 ? message_export::ndjson
+      : message_export::heka_framed;
+  m_export->configure(s);
+  m_download->setLink(Wt::WLink(m_export)); // the url changed
+  m_download->show();
+}
+
+
+void hs::matcher::toggle_follow()
+{
+  if (m_tail.running()) {
+    m_tail.stop();
+    m_follow->setText(tr("follow"));
+    m_tail_status->setText(Wt::WString::tr("follow_stopped").arg(static_cast<double>(m_tail_matches)));
+    return;
+  }
+
+  compiled_matcher mm = m_services->matchers->get(m_mms->text().toUTF8());
+  if (!mm) {
+    m_tail_status->setText("invalid message matcher");
+    return;
+  }
+  m_tail_view->clear();
+  Wt::WTree *tree = new Wt::WTree(m_tail_view);
+  tree->setSelectionMode(Wt::SingleSelection);
+  m_tail_root = new Wt::WTreeNode(tr("messages"));
+  m_tail_root->setStyleClass("tree_results");
+  tree->setTreeRoot(m_tail_root);
+  m_tail_root->label()->setTextFormat(Wt::PlainText);
+  m_tail_root->expand();
+  m_tail_matches = 0;
+
+  if (!m_tail.start(m_hs_cfg->m_hs_output / "input", mm, m_hs_cfg->m_max_message_size,
+                    m_tail_limit, [this](const vector<string> &matches, uint64_t file) {
+                      show_tail(matches, file);
+                    })) {
+    m_tail_status->setText(tr("follow_failed"));
+    return;
+  }
+  m_follow->setText(tr("follow_stop"));
+  m_tail_status->setText(tr("following"));
 }
 
 
-hs::matcher::~matcher()
+void hs::matcher::show_tail(const vector<string> &matches, uint64_t file)
 {
-  lsb_free_heka_message(&m_im.m);
-  lsb_free_input_buffer(&m_im.b);
+  for (auto it = matches.begin(); it != matches.end(); ++it) {
+    m_tail_root->insertChildNode(0, new message_node(*it)); // newest first
+  }
+  const vector<Wt::WTreeNode *> &nodes = m_tail_root->childNodes();
+  while (nodes.size() > m_tail_limit) {
+    Wt::WTreeNode *n = nodes.back();
+    m_tail_root->removeChildNode(n);
+    delete n;
+  }
+  m_tail_matches += matches.size();
+  m_tail_status->setText(Wt::WString::tr("follow_status")
+                         .arg(static_cast<double>(file))
+                         .arg(static_cast<double>(m_tail_matches)));
+  Wt::WApplication::instance()->triggerUpdate();
+}
+
+
+void hs::matcher::mode_changed()
+{
+  int mode = m_mode->currentIndex();
+  m_window->setHidden(mode == 0 || mode == g_explain_mode);
+  m_from->setHidden(mode == g_explain_mode);
+  m_to->setHidden(mode == g_explain_mode);
+  m_samples->setHidden(mode != 0);
 }
 
 
 void hs::matcher::run_matcher()
 {
-  stringstream ss;
-  lsb_message_matcher *mm = lsb_create_message_matcher(m_mms->text().toUTF8().c_str());
+  m_result->clear();
+  m_browser->set_messages(nullptr);
+  string mms = m_mms->text().toUTF8();
+  compiled_matcher mm = m_services->matchers->get(mms);
   if (!mm) {
-    m_result->setText("invalid message matcher");
+    new Wt::WText("invalid message matcher", m_result);
+    return;
+  }
+  const matcher_cache *matchers = m_services->matchers;
+  const message_cache *recent = m_services->recent;
+  Wt::log("debug") << "matcher cache: " << matchers->size() << " entries, "
+                   << matchers->hits() << " hits, " << matchers->misses()
+                   << " misses; message cache: " << recent->bytes() << " bytes, "
+                   << recent->hits() << " hits, " << recent->misses() << " misses";
+
+  scan_options opts = scan_options::from_config(m_hs_cfg->m_max_message_size);
+  opts.queues = selected_queues(m_queues);
+  bool started;
+  int mode = m_mode->currentIndex();
+  if (mode != g_explain_mode
+      && (!parse_time(m_from, false, &opts.min_ts) || !parse_time(m_to, true, &opts.max_ts))) {
+    new Wt::WText(tr("invalid_time_range"), m_result);
     return;
   }
+  if (mode == 0) {
+    started = m_job->start(m_hs_cfg->m_hs_output, mms, mm, opts, m_samples->value(),
+                           [this](const shared_ptr<const scan_result> &r) {
+                             show_result(r);
+                           });
+  } else if (mode == g_explain_mode) {
+    shared_ptr<const scan_result> corpus;
+    if (m_corpus && m_corpus_queues == opts.queues
+        && chrono::steady_clock::now() - m_corpus_time < chrono::seconds(g_corpus_max_age)) {
+      corpus = m_corpus;
+    }
+    size_t corpus_size = 10000;
+    string val;
+    if (Wt::WApplication::instance()->readConfigurationProperty("matcher_explain_messages", val)) {
+      corpus_size = boost::lexical_cast<size_t>(val);
+    }
+    unsigned queues = opts.queues;
+    started = m_job->start(m_hs_cfg->m_hs_output, mms, m_services->matchers, opts, corpus,
+                           corpus_size, [this, queues](const matcher_explain &r) {
+                             show_explain(r, queues);
+                           });
+  } else {
+    int64_t since = 0;
+    int64_t window = g_windows[m_window->currentIndex()].seconds;
+    if (window) {
+      since = (static_cast<int64_t>(time(nullptr)) - window) * 1000000000LL;
+    }
+    started = m_job->start(m_hs_cfg->m_hs_output, mms, mm, opts,
+                           static_cast<scan_aggregate::group>(mode - 1), since,
+                           [this, window](const scan_aggregate &r) {
+                             show_aggregate(r, window);
+                           });
+  }
+  if (!started) {
+    new Wt::WText(tr("job_limit"), m_result);
+  }
+}
+
 
-  fs::path path = m_hs_cfg->m_hs_output;
-  fs::path fn = path / "input" / (get_file_number(path) + ".log");
-  FILE *fh = fopen(fn.string().c_str(), "rb");
-  if (!fh) {
-    ss << "could not open the log: " << fn;
-    m_result->setText(ss.str());
-    lsb_destroy_message_matcher(mm);
+void hs::matcher::show_result(const shared_ptr<const scan_result> &r)
+{
+  if (r->messages.empty()) {
+    new Wt::WText(tr("no_matches"), m_result);
+    new Wt::WBreak(m_result);
+  }
+  Wt::WText *t = new Wt::WText(coverage_message(r->coverage), m_result);
+  t->setStyleClass("scan_coverage");
+  m_browser->set_messages(r);
+}
+
+
+void hs::matcher::show_explain(const matcher_explain &r, unsigned queues)
+{
+  if (r.corpus != m_corpus) {
+    m_corpus = r.corpus;
+    m_corpus_queues = queues;
+    m_corpus_time = chrono::steady_clock::now();
+  }
+  auto age = chrono::steady_clock::now() - m_corpus_time;
+  Wt::WText *t = new Wt::WText(Wt::WString::tr("explain_corpus")
+                               .arg(static_cast<int>(r.messages))
+                               .arg(static_cast<int>(chrono::duration_cast<chrono::seconds>(age).count())),
+                               m_result);
+  t->setStyleClass("scan_coverage");
+  if (r.messages == 0) {
     return;
   }
 
-  size_t cnt = 0;
-  ssize_t bytes_read = 1;
-  size_t discarded_bytes = 0;
-  while (cnt < g_max_messages && bytes_read != 0) {
-    if (lsb_find_heka_message(&m_im.m, &m_im.b, true, &discarded_bytes, NULL)) {
-      if (lsb_eval_message_matcher(mm, &m_im.m)) {
-        output_message(&m_im.m, ss);
-        ss << "\n\n";
-        ++cnt;
-      }
-    } else {
-      bytes_read = read_file(fh, &m_im.b);
+  Wt::WTable *table = new Wt::WTable(m_result);
+  table->setStyleClass("aggregate_groups");
+  table->setHeaderCount(1);
+  new Wt::WText(tr("explain_expression"), table->elementAt(0, 0));
+  new Wt::WText(tr("explain_selectivity"), table->elementAt(0, 1));
+  new Wt::WText(tr("explain_cost"), table->elementAt(0, 2));
+  vector<const matcher_explain::term *> rows(1, &r.total);
+  for (auto it = r.terms.begin(); it != r.terms.end(); ++it) {
+    rows.push_back(&*it);
+  }
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const matcher_explain::term &term = *rows[i];
+    int row = static_cast<int>(i) + 1;
+    string expression = i == 0 || r.op.empty() ? term.expression : r.op + " " + term.expression;
+    Wt::WText *e = new Wt::WText(Wt::WString::fromUTF8(expression), table->elementAt(row, 0));
+    e->setTextFormat(Wt::PlainText);
+    if (!term.valid) {
+      new Wt::WText(tr("explain_invalid_term"), table->elementAt(row, 1));
+      continue;
+    }
+    stringstream selectivity, cost;
+    selectivity << round(term.matches * 1000.0 / r.messages) / 10 << "%";
+    cost << round(term.ns * 10) / 10 << " ns";
+    new Wt::WText(selectivity.str(), table->elementAt(row, 1));
+    new Wt::WText(cost.str(), table->elementAt(row, 2));
+  }
+
+  // every analysis plugin evaluates its matcher on each input queue message
+  double rate = 0;
+  bool known = false;
+  shared_ptr<const plugins_snapshot> ps = m_services->stats->get_plugins();
+  for (auto it = ps->rows.begin(); it != ps->rows.end(); ++it) {
+    if (it->type == "input" && !std::isnan(it->rate[0])) {
+      rate += it->rate[0];
+      known = true;
     }
   }
-  fclose(fh);
-  lsb_destroy_message_matcher(mm);
-  if (cnt == 0) ss << "no matches";
-  m_result->setText(ss.str());
+  if (known && r.total.valid) {
+    t = new Wt::WText(Wt::WString::tr("explain_projection")
+                      .arg(round(rate))
+                      .arg(round(rate * r.total.ns / 1e9 * 1000) / 10), m_result);
+  } else {
+    t = new Wt::WText(tr("explain_no_rate"), m_result);
+  }
+  t->setStyleClass("aggregate_total");
+  if (r.cancelled) {
+    t = new Wt::WText(tr("explain_cancelled"), m_result);
+    t->setStyleClass("scan_coverage");
+  }
+}
+
+
+void hs::matcher::show_aggregate(const scan_aggregate &r, int64_t window)
+{
+  const double mb = 1024 * 1024;
+  double secs = r.elapsed_ms > 0 ? r.elapsed_ms / 1000.0 : 0.001;
+
+  uint64_t peak = 0;
+  for (auto it = r.per_minute.begin(); it != r.per_minute.end(); ++it) {
+    if (it->second > peak) peak = it->second;
+  }
+  int64_t minutes = 1;
+  if (window) {
+    minutes = window / 60;
+  } else if (!r.per_minute.empty()) {
+    minutes = (r.per_minute.back().first - r.per_minute.front().first) / 60 + 1;
+  }
+
+  Wt::WText *t = new Wt::WText(Wt::WString::tr("aggregate_total")
+                               .arg(static_cast<double>(r.total))
+                               .arg(round(static_cast<double>(r.total) / minutes * 10) / 10)
+                               .arg(static_cast<double>(peak)), m_result);
+  t->setStyleClass("aggregate_total");
+  t = new Wt::WText(Wt::WString::tr("scan_throughput")
+                    .arg(round(r.coverage.bytes / mb / secs * 10) / 10)
+                    .arg(round(r.messages / secs))
+                    .arg(round(secs * 10) / 10), m_result);
+  t->setStyleClass("scan_coverage");
+
+  if (r.group_by != scan_aggregate::group_none && !r.top.empty()) {
+    Wt::WTable *table = new Wt::WTable(m_result);
+    table->setStyleClass("aggregate_groups");
+    table->setHeaderCount(1);
+    new Wt::WText(g_group_names[r.group_by], table->elementAt(0, 0));
+    new Wt::WText(tr("aggregate_matches"), table->elementAt(0, 1));
+    new Wt::WText(tr("aggregate_share"), table->elementAt(0, 2));
+    int row = 1;
+    for (auto it = r.top.begin(); it != r.top.end(); ++it, ++row) {
+      Wt::WText *key = new Wt::WText(Wt::WString::fromUTF8(it->first), table->elementAt(row, 0));
+      key->setTextFormat(Wt::PlainText);
+      new Wt::WText(boost::lexical_cast<string>(it->second), table->elementAt(row, 1));
+      stringstream share;
+      share << round(it->second * 1000.0 / r.total) / 10 << "%";
+      new Wt::WText(share.str(), table->elementAt(row, 2));
+    }
+    if (r.groups > r.top.size()) {
+      new Wt::WText(Wt::WString::tr("aggregate_more_groups")
+                    .arg(static_cast<int>(r.groups - r.top.size())), m_result);
+    }
+  }
+
+  if (r.per_minute.size() > 1) {
+    // the last day at most, a chart point per minute
+    size_t first = r.per_minute.size() > 1440 ? r.per_minute.size() - 1440 : 0;
+    Wt::WStandardItemModel *model = new Wt::WStandardItemModel(
+        static_cast<int>(r.per_minute.size() - first), 2, m_result);
+    model->setHeaderData(1, Wt::Horizontal, tr("aggregate_per_minute"));
+    int row = 0;
+    for (size_t i = first; i < r.per_minute.size(); ++i, ++row) {
+      model->setData(row, 0, Wt::WDateTime::fromTime_t(r.per_minute[i].first));
+      model->setData(row, 1, static_cast<double>(r.per_minute[i].second));
+    }
+    Wt::Chart::WCartesianChart *chart = new Wt::Chart::WCartesianChart(m_result);
+    chart->setModel(model);
+    chart->setXSeriesColumn(0);
+    chart->setType(Wt::Chart::ScatterPlot);
+    chart->axis(Wt::Chart::XAxis).setScale(Wt::Chart::DateTimeScale);
+    chart->addSeries(new Wt::Chart::WDataSeries(1, Wt::Chart::LineSeries));
+    chart->setLegendEnabled(true);
+    chart->setPlotAreaPadding(60, Wt::Left | Wt::Top | Wt::Bottom);
+    chart->setPlotAreaPadding(120, Wt::Right);
+    chart->resize(800, 300);
+  }
+
+  t = new Wt::WText(coverage_message(r.coverage), m_result);
+  t->setStyleClass("scan_coverage");
 }
@@ -18,57 +18,287 @@ extern "C"
 }
 #endif
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include <Wt/WAnchor>
 #include <Wt/WTreeNode>
 #include <Wt/WContainerWidget>
+#include <Wt/WComboBox>
 #include <Wt/WLineEdit>
+#include <Wt/WPushButton>
+#include <Wt/WSpinBox>
+#include <Wt/WText>
 #include <boost/filesystem.hpp>
 #include <luasandbox/util/heka_message.h>
 #include <luasandbox/util/heka_message_matcher.h>
 
 #include "hindsight_admin.h"
+#include "matcher_cache.h"
+#include "matcher_explain.h"
+#include "message_browser.h"
+#include "message_cache.h"
+#include "message_export.h"
+#include "queue_index.h"
+#include "queue_tail.h"
+#include "scan_jobs.h"
+#include "scan_pool.h"
 
 namespace mozilla {
 namespace services {
 namespace hindsight {
 
-static const size_t g_max_messages = 5;
+struct scan_coverage {
+  scan_coverage() : files(0), files_total(0), bytes(0), bytes_total(0),
+    budget_exhausted(false), cancelled(false) { }
 
-struct input_msg {
-  lsb_input_buffer b;
-  lsb_heka_message m;
+  size_t    files;            // opened, fully or partially scanned
+  size_t    files_total;      // in the input queue
+  uint64_t  bytes;
+  uint64_t  bytes_total;
+  bool      budget_exhausted; // stopped by the byte or time budget
+  bool      cancelled;        // stopped by the user
 };
 
+
+/**
+ * Scan budget and limits, read from the configuration on the session thread
+ * so the scan itself does not depend on the application instance.
+ */
+struct scan_options {
+  enum queue {
+    input_queue     = 1,
+    analysis_queue  = 2
+  };
+
+  scan_options() : max_bytes(0), max_ms(0), oldest_first(false),
+    max_message_size(0), queues(input_queue),
+    min_ts(std::numeric_limits<int64_t>::min()),
+    max_ts(std::numeric_limits<int64_t>::max()) { }
+
+  static scan_options from_config(size_t max_message_size);
+
+  /**
+   * Directory (under the output_path) and checkpoint key of a queue.
+   */
+  static const char* queue_name(unsigned q);
+
+  uint64_t  max_bytes;        // per queue
+  int       max_ms;
+  bool      oldest_first;
+  size_t    max_message_size;
+  unsigned  queues;           // queue bits
+  int64_t   min_ts;           // time range (ns, inclusive), the queue files
+  int64_t   max_ts;           // are bisected to its start
+};
+
+
+struct scan_result {
+  scan_coverage             coverage;
+  std::vector<std::string>  messages; // raw Heka protobuf, in timestamp order
+  std::vector<unsigned>     queues;   // queue of each message
+};
+
+
+/**
+ * Match counts of an aggregation scan.
+ */
+struct scan_aggregate {
+  enum group {
+    group_none,
+    group_type,
+    group_logger,
+    group_hostname
+  };
+
+  static const size_t top_groups = 20;
+  static const char *other_group; // collects the keys past the group limit
+
+  scan_aggregate() : group_by(group_none), total(0), messages(0), groups(0),
+    elapsed_ms(0) { }
+
+  scan_coverage                                     coverage;
+  group                                             group_by;
+  uint64_t                                          total;      // matches
+  uint64_t                                          messages;   // evaluated
+  size_t                                            groups;     // distinct keys
+  std::vector<std::pair<std::string, uint64_t> >    top;        // largest first
+  std::vector<std::pair<int64_t, uint64_t> >        per_minute; // epoch s, matches
+  int64_t                                           elapsed_ms;
+};
+
+
+/**
+ * Runs the message matcher over the input queue in the background: shows the
+ * progress of the scan with a Cancel button and hands the result back to the
+ * owning widget on completion (a cancelled scan returns what it found so far).
+ */
+class scan_job : public Wt::WContainerWidget {
+public:
+  typedef std::function<void(const std::shared_ptr<const scan_result> &r)> completion;
+
+  scan_job(const services *svc, Wt::WContainerWidget *parent = 0);
+  ~scan_job();
+
+  /**
+   * Starts a scan, abandoning the one in progress.
+   *
+   * @return bool False if the session has reached its job limit
+   */
+  bool start(const boost::filesystem::path &path, const std::string &mms,
+             const compiled_matcher &mm, const scan_options &opts,
+             size_t max_matches, const completion &cb);
+
+  /**
+   * Starts counting the matches, abandoning the scan in progress.
+   *
+   * @param since Only messages at or after this timestamp (ns) are counted
+   */
+  bool start(const boost::filesystem::path &path, const std::string &mms,
+             const compiled_matcher &mm, const scan_options &opts,
+             scan_aggregate::group g, int64_t since,
+             const std::function<void(const scan_aggregate &r)> &cb);
+
+  /**
+   * Benchmarks the matcher and its top level terms, sampling up to
+   * corpus_size of the latest messages first when no corpus is given.
+   */
+  bool start(const boost::filesystem::path &path, const std::string &mms,
+             matcher_cache *matchers, const scan_options &opts,
+             const std::shared_ptr<const scan_result> &corpus, size_t corpus_size,
+             const std::function<void(const matcher_explain &r)> &cb);
+
+  bool running() const { return m_id >= 0; }
+
+private:
+  bool submit(const scan_jobs::work &w, const std::function<void()> &cb);
+  void update(const scan_progress &p, bool done);
+  void cancel();
+
+  const services                *m_services;
+  int                           m_id;
+  std::function<void()>         m_cb;
+  // pointers managed by the container
+  Wt::WText                     *m_progress;
+  Wt::WPushButton               *m_cancel;
+  // end managed pointers
+};
+
+
 class matcher : public Wt::WContainerWidget {
 public:
-  matcher(const hindsight_cfg *hs_cfg);
-  ~matcher();
+  matcher(const services *svc);
 
 private:
   void run_matcher();
+  void mode_changed();
+  void show_result(const std::shared_ptr<const scan_result> &r);
+  void show_aggregate(const scan_aggregate &r, int64_t window);
+  void show_explain(const matcher_explain &r, unsigned queues);
+  void prepare_export();
+  void toggle_follow();
+  void show_tail(const std::vector<std::string> &matches, uint64_t file);
 
-  const hindsight_cfg *m_hs_cfg;
+  const services                        *m_services;
+  const hindsight_cfg                   *m_hs_cfg;
+  std::shared_ptr<const scan_result>    m_corpus; // explain benchmark input
+  unsigned                              m_corpus_queues;
+  std::chrono::steady_clock::time_point m_corpus_time;
+  queue_tail                            m_tail;
+  size_t                                m_tail_limit;
+  uint64_t                              m_tail_matches;
+  message_export                        *m_export; // owned by the widget
   // pointers managed by the container
   Wt::WLineEdit         *m_mms;
-  Wt::WText             *m_result;
+  Wt::WComboBox         *m_mode;
+  Wt::WComboBox         *m_window;
+  Wt::WLineEdit         *m_from;
+  Wt::WLineEdit         *m_to;
+  Wt::WComboBox         *m_queues;
+  Wt::WSpinBox          *m_samples;
+  scan_job              *m_job;
+  Wt::WContainerWidget  *m_result;
+  message_browser       *m_browser;
+  Wt::WPushButton       *m_follow;
+  Wt::WText             *m_tail_status;
+  Wt::WContainerWidget  *m_tail_view;
+  Wt::WTreeNode         *m_tail_root;
+  Wt::WComboBox         *m_export_format;
+  Wt::WComboBox         *m_export_window;
+  Wt::WAnchor           *m_download;
   // end managed pointers
-  struct input_msg      m_im;
 };
 
-size_t
-run_matcher(const boost::filesystem::path &path,
+/**
+ * Validates the plugin configuration and starts scanning the input queue for
+ * its message matcher.
+ *
+ * @return bool False if the configuration is invalid or the job could not be
+ *              started (err_msg is set)
+ */
+bool
+run_matcher(scan_job *job,
+            matcher_cache *matchers,
+            const boost::filesystem::path &path,
             const std::string &cfg,
             const std::string &user,
-            Wt::WContainerWidget *c,
-            struct input_msg *msgs,
-            size_t msgs_size,
+            size_t max_message_size,
+            unsigned queues,
+            size_t max_matches,
+            const scan_job::completion &cb,
             std::string *err_msg);
 
+/**
+ * Describes how much of the input queue a matcher run covered.
+ */
+Wt::WString coverage_message(const scan_coverage &cov);
+
+/**
+ * Appends the tester summary of a sample: no_matches when it is empty and
+ * the coverage of the scan.
+ */
+void show_matches(const scan_result &r, Wt::WContainerWidget *parent);
+
+/**
+ * @param mm Receives the compiled message matcher (may be NULL)
+ */
 lua_State* validate_cfg(const std::string &cfg, const std::string &user,
-                        lsb_message_matcher **mm, std::string *err_msg);
+                        matcher_cache *matchers, compiled_matcher *mm,
+                        std::string *err_msg);
+
+/**
+ * Adds the queue choice (input, analysis or both merged into one timeline).
+ */
+Wt::WComboBox* queue_selector(Wt::WContainerWidget *c);
+
+/**
+ * @return unsigned scan_options queue bits of the selected choice
+ */
+unsigned selected_queues(const Wt::WComboBox *selector);
+
+/**
+ * Lists the files of a queue up to its checkpoint, oldest first.
+ *
+ * @return Each file with the offset up to which it is checkpointed (SIZE_MAX
+ *         for the whole file)
+ */
+std::vector<std::pair<boost::filesystem::path, size_t> >
+checkpointed_files(const boost::filesystem::path &path, unsigned queue);
+
+/**
+ * Adds the number of messages to sample, capped by matcher_max_samples.
+ */
+Wt::WSpinBox* sample_size_selector(Wt::WContainerWidget *c);
 
-void output_message(lsb_heka_message *m, Wt::WTreeNode *root);
+/**
+ * @return Wt::WTreeNode* Node of the message added to root
+ */
+Wt::WTreeNode* output_message(lsb_heka_message *m, Wt::WTreeNode *root);
 
 }
 }
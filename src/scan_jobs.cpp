@@ -0,0 +1,189 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Background Scan Jobs Implementation @file
+
+#include "scan_jobs.h"
+
+#include <exception>
+#include <vector>
+
+#include <Wt/WLogger>
+#include <Wt/WServer>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+static const chrono::milliseconds g_progress_interval(250);
+
+
+hs::scan_jobs::scan_jobs() :
+    m_per_session(1),
+    m_next_id(0),
+    m_stopped(false) { }
+
+
+hs::scan_jobs::~scan_jobs()
+{
+  stop();
+}
+
+
+void hs::scan_jobs::start(unsigned per_session)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_per_session = per_session ? per_session : 1;
+  m_stopped = false;
+}
+
+
+void hs::scan_jobs::stop()
+{
+  vector<thread> threads;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stopped = true;
+    for (auto it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+      it->second.progress->cancel = true;
+      it->second.cb = nullptr;
+      threads.push_back(move(it->second.thread));
+    }
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    if (it->joinable()) it->join();
+  }
+  lock_guard<mutex> lock(m_mutex);
+  m_jobs.clear();
+}
+
+
+int hs::scan_jobs::submit(const string &session_id, const work &w, const listener &cb)
+{
+  reap();
+  lock_guard<mutex> lock(m_mutex);
+  if (m_stopped) {
+    return -1;
+  }
+  unsigned active = 0;
+  for (auto it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+    if (it->second.cb && it->second.session_id == session_id) ++active;
+  }
+  if (active >= m_per_session) {
+    return -1;
+  }
+
+  int id = ++m_next_id;
+  job &j = m_jobs[id];
+  j.session_id = session_id;
+  j.cb = cb;
+  j.progress = make_shared<scan_progress>();
+  j.progress->changed = [this, id]() { post(id, false); };
+  j.done = false;
+  j.thread = thread(&scan_jobs::run, this, id, w);
+  return id;
+}
+
+
+void hs::scan_jobs::cancel(int id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_jobs.find(id);
+  if (it != m_jobs.end()) {
+    it->second.progress->cancel = true;
+  }
+}
+
+
+void hs::scan_jobs::release(int id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_jobs.find(id);
+  if (it != m_jobs.end()) {
+    it->second.progress->cancel = true;
+    it->second.cb = nullptr;
+  }
+}
+
+
+void hs::scan_jobs::run(int id, work w)
+{
+  shared_ptr<scan_progress> progress;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    progress = m_jobs[id].progress;
+  }
+  try {
+    w(progress.get());
+  } catch (exception &e) {
+    Wt::log("error") << "scan job failed: " << e.what();
+  }
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_jobs[id].done = true;
+  }
+  post(id, true);
+}
+
+
+void hs::scan_jobs::post(int id, bool done)
+{
+  Wt::WServer *server = Wt::WServer::instance();
+  if (!server) return;
+
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_jobs.find(id);
+  if (it == m_jobs.end() || !it->second.cb) {
+    return; // cancelled
+  }
+  auto now = chrono::steady_clock::now();
+  if (!done && now - it->second.posted < g_progress_interval) {
+    return;
+  }
+  it->second.posted = now;
+  // a session that went away cannot receive the result, release its slot
+  server->post(it->second.session_id, [this, id, done]() { deliver(id, done); },
+               [this, id]() { release(id); });
+}
+
+
+void hs::scan_jobs::deliver(int id, bool done)
+{
+  listener cb;
+  shared_ptr<scan_progress> progress;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_jobs.find(id);
+    if (it == m_jobs.end() || !it->second.cb) {
+      return; // cancelled while the update was queued
+    }
+    cb = it->second.cb;
+    progress = it->second.progress;
+    if (done) {
+      it->second.cb = nullptr;
+    }
+  }
+  cb(*progress, done);
+}
+
+
+void hs::scan_jobs::reap()
+{
+  vector<thread> threads;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+      if (it->second.done && !it->second.cb) {
+        threads.push_back(move(it->second.thread));
+        it = m_jobs.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    if (it->joinable()) it->join();
+  }
+}
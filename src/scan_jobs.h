@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Background Scan Jobs @file
+
+#ifndef hindsight_admin_scan_jobs_h_
+#define hindsight_admin_scan_jobs_h_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Live state of a running scan, updated by the scan threads.
+ */
+struct scan_progress {
+  scan_progress() : bytes(0), matches(0), cancel(false) { }
+
+  std::atomic<uint64_t>   bytes;
+  std::atomic<uint64_t>   matches;
+  std::atomic<bool>       cancel;
+  std::function<void()>   changed; // called by the scan threads, may be empty
+};
+
+
+/**
+ * Server wide runner of the matcher scans. Each job gets its own thread (the
+ * heavy lifting happens on the scan_pool) so the Wt request threads are never
+ * blocked; progress and completion are delivered to the submitting session
+ * through WServer::post at most a few times a second. The number of
+ * concurrent jobs per session is capped.
+ */
+class scan_jobs {
+public:
+  typedef std::function<void(scan_progress *progress)> work;
+  typedef std::function<void(const scan_progress &progress, bool done)> listener;
+
+  scan_jobs();
+  ~scan_jobs();
+
+  void start(unsigned per_session);
+
+  /**
+   * Cancels and waits for all jobs.
+   */
+  void stop();
+
+  /**
+   * @param session_id Session receiving the progress/completion callbacks
+   * @param w Work, runs on the job thread
+   * @param cb Listener, runs in the session
+   *
+   * @return int Job id or -1 if the session has reached its limit
+   */
+  int submit(const std::string &session_id, const work &w, const listener &cb);
+
+  /**
+   * Requests cancellation; the listener still receives the completion (with
+   * whatever the work had produced so far).
+   */
+  void cancel(int id);
+
+  /**
+   * Requests cancellation; the listener is not called anymore.
+   */
+  void release(int id);
+
+private:
+  struct job {
+    std::string                           session_id;
+    listener                              cb;
+    std::shared_ptr<scan_progress>        progress;
+    std::thread                           thread;
+    bool                                  done;
+    std::chrono::steady_clock::time_point posted;
+  };
+
+  void run(int id, work w);
+  void post(int id, bool done);
+  void deliver(int id, bool done);
+  void reap();
+
+  unsigned                  m_per_session;
+  int                       m_next_id;
+  bool                      m_stopped;
+  std::map<int, job>        m_jobs;
+  std::mutex                m_mutex;
+};
+
+}
+}
+}
+#endif
@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Scan Worker Pool Implementation @file
+
+#include "scan_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+hs::scan_pool::scan_pool() :
+    m_stop(false) { }
+
+
+hs::scan_pool::~scan_pool()
+{
+  stop();
+}
+
+
+void hs::scan_pool::start(unsigned threads)
+{
+  if (!m_threads.empty()) {
+    return;
+  }
+  m_stop = false;
+  for (unsigned i = 0; i < threads; ++i) {
+    m_threads.push_back(thread(&scan_pool::worker, this));
+  }
+}
+
+
+void hs::scan_pool::stop()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+    it->join();
+  }
+  m_threads.clear();
+}
+
+
+void hs::scan_pool::run(size_t n, const task_fn &fn)
+{
+  if (n == 0) {
+    return;
+  }
+  batch b;
+  b.fn = &fn;
+  b.n = n;
+  b.next = 0;
+  b.running = 0;
+  b.slots = 0;
+
+  unique_lock<mutex> lock(m_mutex);
+  if (n > 1) {
+    m_queue.push_back(&b);
+    m_cv.notify_all();
+  }
+  work(&b, lock);
+  b.done.wait(lock, [&b] { return b.next == b.n && b.running == 0; });
+}
+
+
+void hs::scan_pool::worker()
+{
+  unique_lock<mutex> lock(m_mutex);
+  for (;;) {
+    m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+    if (m_stop) {
+      return;
+    }
+    work(m_queue.front(), lock);
+  }
+}
+
+
+void hs::scan_pool::work(batch *b, unique_lock<mutex> &lock)
+{
+  unsigned slot = b->slots++;
+  while (b->next < b->n) {
+    size_t task = b->next++;
+    if (b->next == b->n) {
+      // fully claimed, nobody else can join
+      auto it = find(m_queue.begin(), m_queue.end(), b);
+      if (it != m_queue.end()) m_queue.erase(it);
+    }
+    ++b->running;
+    lock.unlock();
+    (*b->fn)(task, slot);
+    lock.lock();
+    --b->running;
+  }
+  if (b->running == 0) {
+    b->done.notify_all();
+  }
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Scan Worker Pool @file
+
+#ifndef hindsight_admin_scan_pool_h_
+#define hindsight_admin_scan_pool_h_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Server wide bounded pool for the queue scans. A batch of tasks is worked
+ * on by the idle pool threads together with the submitting request thread so
+ * concurrent sessions share the cores instead of each spawning their own
+ * threads. Batches are served in submission order.
+ */
+class scan_pool {
+public:
+  /**
+   * @param task Index of the task in [0, n)
+   * @param slot Participant id in [0, slots()), stable for the thread for the
+   *             duration of the batch (for per worker state)
+   */
+  typedef std::function<void(size_t task, unsigned slot)> task_fn;
+
+  scan_pool();
+  ~scan_pool();
+
+  void start(unsigned threads);
+  void stop();
+
+  /**
+   * Maximum number of participants in a batch (the pool threads plus the
+   * caller).
+   */
+  unsigned slots() const { return static_cast<unsigned>(m_threads.size()) + 1; }
+
+  /**
+   * Runs fn for every task of the batch and returns once all of them have
+   * completed; fn must not throw.
+   */
+  void run(size_t n, const task_fn &fn);
+
+private:
+  struct batch {
+    const task_fn           *fn;
+    size_t                  n;
+    size_t                  next;    // next task to claim
+    size_t                  running;
+    unsigned                slots;   // participants so far
+    std::condition_variable done;
+  };
+
+  void worker();
+  void work(batch *b, std::unique_lock<std::mutex> &lock);
+
+  std::mutex                m_mutex;
+  std::condition_variable   m_cv;
+  std::deque<batch *>       m_queue;
+  std::vector<std::thread>  m_threads;
+  bool                      m_stop;
+};
+
+}
+}
+}
+#endif
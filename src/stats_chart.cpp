@@ -0,0 +1,91 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats History Chart Implementation @file
+
+#include "stats_chart.h"
+
+#include <ctime>
+#include <vector>
+
+#include <Wt/Chart/WDataSeries>
+#include <Wt/WDateTime>
+
+#include "hindsight_admin.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+static const hs::stats_store::resolution g_resolution[] = {
+  hs::stats_store::minute, hs::stats_store::hour
+};
+static const int64_t g_range[] = { 24 * 3600, 7 * 24 * 3600 };
+
+
+hs::stats_chart::stats_chart(stats_collector *stats, stats_collector::stats_source f,
+                             const string &series) :
+    m_collector(stats),
+    m_source(f),
+    m_series(series)
+{
+  m_column = new Wt::WComboBox(this);
+  const vector<string> &columns = stats_collector::history_columns(f);
+  for (auto it = columns.begin(); it != columns.end(); ++it) {
+    m_column->addItem(tr(*it));
+  }
+  m_column->activated().connect(this, &hs::stats_chart::load);
+
+  m_range = new Wt::WComboBox(this);
+  m_range->addItem(tr("history_day"));
+  m_range->addItem(tr("history_week"));
+  m_range->setCurrentIndex(1);
+  m_range->activated().connect(this, &hs::stats_chart::load);
+
+  m_empty = new Wt::WText(tr("history_none"), this);
+
+  m_model = new Wt::WStandardItemModel(0, 4, this);
+  m_model->setHeaderData(1, Wt::Horizontal, tr("history_min"));
+  m_model->setHeaderData(2, Wt::Horizontal, tr("history_avg"));
+  m_model->setHeaderData(3, Wt::Horizontal, tr("history_max"));
+
+  m_chart = new Wt::Chart::WCartesianChart(this);
+  m_chart->setModel(m_model);
+  m_chart->setXSeriesColumn(0);
+  m_chart->setType(Wt::Chart::ScatterPlot);
+  m_chart->axis(Wt::Chart::XAxis).setScale(Wt::Chart::DateTimeScale);
+  for (int i = 1; i < 4; ++i) {
+    m_chart->addSeries(new Wt::Chart::WDataSeries(i, Wt::Chart::LineSeries));
+  }
+  m_chart->setLegendEnabled(true);
+  m_chart->setPlotAreaPadding(60, Wt::Left | Wt::Top | Wt::Bottom);
+  m_chart->setPlotAreaPadding(120, Wt::Right);
+  m_chart->resize(800, 350);
+
+  load();
+}
+
+
+void hs::stats_chart::load()
+{
+  int range = m_range->currentIndex();
+  int64_t to = time(nullptr);
+  vector<stats_store::point> points;
+  m_collector->read_history(m_source, m_series, g_resolution[range],
+                            m_column->currentIndex(), to - g_range[range], to,
+                            points);
+
+  m_model->removeRows(0, m_model->rowCount());
+  m_model->insertRows(0, static_cast<int>(points.size()));
+  int row = 0;
+  for (auto it = points.begin(); it != points.end(); ++it, ++row) {
+    m_model->setData(row, 0, Wt::WDateTime::fromTime_t(it->time));
+    m_model->setData(row, 1, static_cast<double>(it->min));
+    m_model->setData(row, 2, static_cast<double>(it->avg));
+    m_model->setData(row, 3, static_cast<double>(it->max));
+  }
+  m_empty->setHidden(!points.empty());
+  m_chart->setHidden(points.empty());
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats History Chart @file
+
+#ifndef hindsight_admin_stats_chart_h_
+#define hindsight_admin_stats_chart_h_
+
+#include <string>
+
+#include <Wt/Chart/WCartesianChart>
+#include <Wt/WComboBox>
+#include <Wt/WContainerWidget>
+#include <Wt/WStandardItemModel>
+#include <Wt/WText>
+
+#include "stats_collector.h"
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Min/avg/max chart of one persisted column of a plugin or utilization row,
+ * read from the minute (last day) or hour (last week) rollups.
+ */
+class stats_chart : public Wt::WContainerWidget {
+public:
+  stats_chart(stats_collector *stats, stats_collector::stats_source f,
+              const std::string &series);
+
+private:
+  void load();
+
+  stats_collector                 *m_collector;
+  stats_collector::stats_source   m_source;
+  std::string                     m_series;
+
+// pointers managed by the application
+  Wt::WComboBox                   *m_column;
+  Wt::WComboBox                   *m_range;
+  Wt::WText                       *m_empty;
+  Wt::WStandardItemModel          *m_model;
+  Wt::Chart::WCartesianChart      *m_chart;
+// end managed pointers
+};
+
+}
+}
+}
+#endif
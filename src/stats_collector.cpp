@@ -0,0 +1,315 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats Collector Implementation @file
+
+#include "stats_collector.h"
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <sys/inotify.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <Wt/WLogger>
+#include <Wt/WServer>
+
+#include "file_watcher.h"
+#include "hindsight_admin.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+// plugins.tsv columns persisted after the rates
+static const int g_plugin_history[] = { 4, 8, 10, 12 }; // cur_mem, mm_avg, pm_avg, te_avg
+static const int g_plugin_history_size = hs::plugin_stats::rates
+    + sizeof(g_plugin_history) / sizeof(g_plugin_history[0]);
+
+static const vector<string> g_plugin_history_ids = {
+  "im_rate", "pm_rate", "pm_failure_rate", "cur_mem", "mm_avg", "pm_avg", "te_avg"
+};
+
+static const vector<string> g_utilization_history_ids = {
+  "messages_processed", "%utilization", "%message_matcher", "%process_message", "%timer_event"
+};
+
+
+hs::stats_collector::stats_collector() :
+    m_hs_cfg(nullptr),
+    m_watcher(nullptr),
+    m_watch_id(-1),
+    m_next_id(0),
+    m_plugins_store("plugins", g_plugin_history_size),
+    m_utilization_store("utilization", utilization_stats::columns),
+    m_changed(0),
+    m_stop(false),
+    m_plugins(make_shared<plugins_snapshot>()),
+    m_utilization(make_shared<utilization_snapshot>()) { }
+
+
+hs::stats_collector::~stats_collector()
+{
+  stop();
+}
+
+
+void hs::stats_collector::start(const hindsight_cfg *cfg, file_watcher *fw,
+                                const fs::path &store_root)
+{
+  m_hs_cfg = cfg;
+  m_watcher = fw;
+  if (!store_root.empty()) {
+    m_plugins_store.open(store_root);
+    m_utilization_store.open(store_root);
+  }
+  load_plugins();
+  load_utilization();
+  m_stop = false;
+  m_watch_id = m_watcher->watch(m_hs_cfg->m_hs_output, IN_CLOSE_WRITE | IN_MOVED_TO,
+                                [this](const string &name, uint32_t mask)
+                                {
+                                  changed(name, mask);
+                                });
+  m_thread = thread(&stats_collector::run, this);
+}
+
+
+void hs::stats_collector::stop()
+{
+  if (m_watch_id >= 0) {
+    m_watcher->unwatch(m_watch_id);
+    m_watch_id = -1;
+  }
+  {
+    lock_guard<mutex> lock(m_run_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  m_plugins_store.close();
+  m_utilization_store.close();
+  lock_guard<mutex> lock(m_mutex);
+  m_subscribers.clear();
+}
+
+
+shared_ptr<const hs::plugins_snapshot> hs::stats_collector::get_plugins() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_plugins;
+}
+
+
+shared_ptr<const hs::utilization_snapshot> hs::stats_collector::get_utilization() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_utilization;
+}
+
+
+const vector<string>& hs::stats_collector::history_columns(stats_source f)
+{
+  return f == plugins_file ? g_plugin_history_ids : g_utilization_history_ids;
+}
+
+
+bool hs::stats_collector::read_history(stats_source f, const string &series,
+                                       stats_store::resolution r, int column,
+                                       int64_t from, int64_t to,
+                                       vector<stats_store::point> &points) const
+{
+  const stats_store &store = f == plugins_file ? m_plugins_store : m_utilization_store;
+  return store.read(series, r, column, from, to, points);
+}
+
+
+int hs::stats_collector::subscribe(stats_source f, const string &session_id,
+                                   const listener &cb)
+{
+  lock_guard<mutex> lock(m_mutex);
+  subscriber s = { f, session_id, cb };
+  m_subscribers[++m_next_id] = s;
+  return m_next_id;
+}
+
+
+void hs::stats_collector::unsubscribe(int id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_subscribers.erase(id);
+}
+
+
+void hs::stats_collector::changed(const string &name, uint32_t mask)
+{
+  bool overflow = mask & IN_Q_OVERFLOW;
+  unsigned changed = 0;
+  if (overflow || name == m_hs_cfg->m_plugins.filename().string()) {
+    changed |= 1 << plugins_file;
+  }
+  if (overflow || name == m_hs_cfg->m_utilization.filename().string()) {
+    changed |= 1 << utilization_file;
+  }
+  if (!changed) return;
+
+  {
+    lock_guard<mutex> lock(m_run_mutex);
+    m_changed |= changed;
+  }
+  m_cv.notify_all();
+}
+
+
+void hs::stats_collector::run()
+{
+  unique_lock<mutex> lock(m_run_mutex);
+  for (;;) {
+    m_cv.wait(lock, [this] { return m_stop || m_changed; });
+    if (m_stop) break;
+    unsigned changed = m_changed;
+    m_changed = 0;
+    lock.unlock();
+    if ((changed & (1 << plugins_file)) && load_plugins()) {
+      notify(plugins_file);
+    }
+    if ((changed & (1 << utilization_file)) && load_utilization()) {
+      notify(utilization_file);
+    }
+    lock.lock();
+  }
+}
+
+
+void hs::stats_collector::notify(stats_source f)
+{
+  Wt::WServer *server = Wt::WServer::instance();
+  if (!server) return;
+
+  lock_guard<mutex> lock(m_mutex);
+  for (auto it = m_subscribers.begin(); it != m_subscribers.end(); ++it) {
+    if (it->second.file == f) {
+      int id = it->first;
+      server->post(it->second.session_id, [this, id]() { deliver(id); });
+    }
+  }
+}
+
+
+void hs::stats_collector::deliver(int id)
+{
+  listener cb;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_subscribers.find(id);
+    if (it == m_subscribers.end()) {
+      return; // the widget went away while the update was queued
+    }
+    cb = it->second.cb;
+  }
+  cb();
+}
+
+
+bool hs::stats_collector::load_plugins()
+{
+  if (m_hs_cfg->m_plugins.empty()) {
+    return false;
+  }
+
+  if (!m_plugins_file.load(m_hs_cfg->m_plugins, plugin_stats::columns)) {
+    Wt::log("error") << "invalid stats file: " << m_plugins_file.error();
+    return false;
+  }
+
+  auto snapshot = make_shared<plugins_snapshot>();
+  size_t rows = m_plugins_file.rows();
+  snapshot->rows.resize(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    plugin_stats &ps = snapshot->rows[i];
+    boost::string_ref plugin = m_plugins_file.name(i);
+    size_t pos = plugin.find('.');
+    ps.type = plugin.substr(0, pos).to_string();
+    ps.name = plugin.substr(pos + 1).to_string();
+    for (int col = 0; col < plugin_stats::columns; ++col) {
+      ps.values[col] = m_plugins_file.value(i, col);
+    }
+  }
+  chrono::duration<double> now = chrono::steady_clock::now().time_since_epoch();
+  m_history.add(now.count(), *snapshot);
+
+  int64_t t = time(nullptr);
+  float v[g_plugin_history_size];
+  for (auto it = snapshot->rows.begin(); it != snapshot->rows.end(); ++it) {
+    if (std::isnan(it->rate[0])) {
+      continue; // no rate for the first sample of a plugin
+    }
+    int c = 0;
+    for (int i = 0; i < plugin_stats::rates; ++i) {
+      v[c++] = static_cast<float>(it->rate[i]);
+    }
+    for (int col : g_plugin_history) {
+      v[c++] = static_cast<float>(it->values[col]);
+    }
+    m_plugins_store.add(t, it->type + "." + it->name, v);
+  }
+  m_plugins_store.commit(t);
+
+  lock_guard<mutex> lock(m_mutex);
+  m_plugins = snapshot;
+  return true;
+}
+
+
+bool hs::stats_collector::load_utilization()
+{
+  if (m_hs_cfg->m_utilization.empty()) {
+    return false;
+  }
+
+  if (!m_utilization_file.load(m_hs_cfg->m_utilization, utilization_stats::columns)) {
+    Wt::log("error") << "invalid stats file: " << m_utilization_file.error();
+    return false;
+  }
+
+  auto snapshot = make_shared<utilization_snapshot>();
+  size_t rows = m_utilization_file.rows();
+  snapshot->rows.resize(rows);
+  bool analysis = false;
+  for (size_t i = 0; i < rows; ++i) {
+    utilization_stats &us = snapshot->rows[i];
+    us.name = m_utilization_file.name(i).to_string();
+    // analysis.* plugin rows must follow their analysis thread row
+    if (boost::starts_with(us.name, "analysis.")) {
+      if (!analysis) {
+        Wt::log("error") << "invalid utilization row order: " << us.name;
+        return false;
+      }
+    } else {
+      analysis = boost::starts_with(us.name, "analysis");
+    }
+    for (int col = 0; col < utilization_stats::columns; ++col) {
+      us.values[col] = static_cast<int>(m_utilization_file.value(i, col));
+    }
+  }
+
+  int64_t t = time(nullptr);
+  float v[utilization_stats::columns];
+  for (auto it = snapshot->rows.begin(); it != snapshot->rows.end(); ++it) {
+    for (int col = 0; col < utilization_stats::columns; ++col) {
+      v[col] = static_cast<float>(it->values[col]);
+    }
+    m_utilization_store.add(t, it->name, v);
+  }
+  m_utilization_store.commit(t);
+
+  lock_guard<mutex> lock(m_mutex);
+  m_utilization = snapshot;
+  return true;
+}
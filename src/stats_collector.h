@@ -0,0 +1,156 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats Collector @file
+
+#ifndef hindsight_admin_stats_collector_h_
+#define hindsight_admin_stats_collector_h_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dir_cache.h"
+#include "stats_file.h"
+#include "stats_history.h"
+#include "stats_store.h"
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+struct hindsight_cfg;
+class file_watcher;
+
+struct plugin_stats {
+  static const int columns = 14;
+  static const int rates = stats_history::counters;
+
+  std::string type;
+  std::string name;
+  double      values[columns];
+  double      rate[rates];  // IM/s, PM/s, PM failures/min (NaN if unknown)
+  std::string trend;        // message rate sparkline
+};
+
+
+struct plugins_snapshot {
+  std::vector<plugin_stats> rows;
+};
+
+
+struct utilization_stats {
+  static const int columns = 5;
+
+  std::string name;
+  int         values[columns];
+};
+
+
+struct utilization_snapshot {
+  std::vector<utilization_stats> rows;
+};
+
+
+/**
+ * Server wide reader of the hindsight plugins.tsv and utilization.tsv files.
+ * Each file is parsed once per change (inotify on the output_path) on the
+ * collector thread, persisted and published as an immutable snapshot shared
+ * by all sessions. Subscribed sessions are notified through WServer::post.
+ */
+class stats_collector {
+public:
+  enum stats_source {
+    plugins_file,
+    utilization_file
+  };
+  typedef std::function<void()> listener;
+
+  stats_collector();
+  ~stats_collector();
+
+  /**
+   * Loads the current stats and starts watching for changes.
+   *
+   * @param cfg Hindsight configuration
+   * @param fw Watcher dispatching the output_path events
+   * @param store_root Directory of the persistent stats history (disabled if
+   *                   empty)
+   */
+  void start(const hindsight_cfg *cfg, file_watcher *fw,
+             const boost::filesystem::path &store_root);
+  void stop();
+
+  std::shared_ptr<const plugins_snapshot> get_plugins() const;
+  std::shared_ptr<const utilization_snapshot> get_utilization() const;
+
+  /**
+   * Message ids of the persisted columns, in store column order.
+   */
+  static const std::vector<std::string>& history_columns(stats_source f);
+
+  /**
+   * Reads the persisted rollups of one plugin (type.name) or utilization row.
+   */
+  bool read_history(stats_source f, const std::string &series,
+                    stats_store::resolution r, int column, int64_t from,
+                    int64_t to, std::vector<stats_store::point> &points) const;
+
+  /**
+   * Shared cache of the plugin run/load directory listings.
+   */
+  dir_cache* get_dirs() { return &m_dirs; }
+
+  int subscribe(stats_source f, const std::string &session_id, const listener &cb);
+  void unsubscribe(int id);
+
+private:
+  struct subscriber {
+    stats_source file;
+    std::string  session_id;
+    listener     cb;
+  };
+
+  void changed(const std::string &name, uint32_t mask);
+  void run();
+  void notify(stats_source f);
+  void deliver(int id);
+  bool load_plugins();
+  bool load_utilization();
+
+  const hindsight_cfg     *m_hs_cfg;
+  file_watcher            *m_watcher;
+  int                     m_watch_id;
+  int                     m_next_id;
+  std::map<int, subscriber> m_subscribers;
+  stats_file              m_plugins_file;     // collector thread only
+  stats_file              m_utilization_file; // collector thread only
+  stats_history           m_history;          // collector thread only
+  stats_store             m_plugins_store;
+  stats_store             m_utilization_store;
+  dir_cache               m_dirs;
+
+  mutable std::mutex      m_mutex;
+  std::mutex              m_run_mutex;
+  std::condition_variable m_cv;
+  unsigned                m_changed;  // bit per stats_source
+  bool                    m_stop;
+  std::thread             m_thread;
+
+  std::shared_ptr<const plugins_snapshot>     m_plugins;
+  std::shared_ptr<const utilization_snapshot> m_utilization;
+};
+
+}
+}
+}
+#endif
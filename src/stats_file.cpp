@@ -0,0 +1,191 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats File Reader Implementation @file
+
+#include "stats_file.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const double g_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+bool hs::parse_double(const char *p, const char *e, double *d)
+{
+  const char *s = p;
+  bool neg = false;
+  if (p < e && (*p == '-' || *p == '+')) {
+    neg = *p == '-';
+    ++p;
+  }
+
+  uint64_t m = 0;
+  int digits = 0;
+  int frac = 0;
+  for (; p < e && static_cast<unsigned>(*p - '0') < 10; ++p, ++digits) {
+    m = m * 10 + (*p - '0');
+  }
+  if (p < e && *p == '.') {
+    for (++p; p < e && static_cast<unsigned>(*p - '0') < 10; ++p, ++digits, ++frac) {
+      m = m * 10 + (*p - '0');
+    }
+  }
+
+  // the mantissa and the power of ten are both exact so a single division is
+  // correctly rounded
+  if (p == e && digits > 0 && digits <= 15) {
+    double v = static_cast<double>(m);
+    if (frac) v /= g_pow10[frac];
+    *d = neg ? -v : v;
+    return true;
+  }
+
+  char tmp[64];
+  size_t len = e - s;
+  if (len == 0 || len >= sizeof tmp) {
+    return false;
+  }
+  memcpy(tmp, s, len);
+  tmp[len] = 0;
+  char *end;
+  double v = strtod(tmp, &end);
+  if (end != tmp + len) {
+    return false;
+  }
+  *d = v;
+  return true;
+}
+
+
+hs::stats_file::stats_file() :
+    m_rows(0),
+    m_columns(0) { }
+
+
+bool hs::stats_file::load(const fs::path &fn, int columns)
+{
+  m_names.clear();
+  int fd = open(fn.string().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    m_error = fn.string() + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  size_t size = 4096;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size = st.st_size + 1; // the extra byte detects growth since the stat
+  }
+  if (m_buf.size() < size) {
+    m_buf.resize(size);
+  }
+
+  size_t len = 0;
+  for (;;) {
+    ssize_t n = read(fd, &m_buf[len], m_buf.size() - len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      m_error = fn.string() + ": " + strerror(errno);
+      close(fd);
+      return false;
+    }
+    if (n == 0) break;
+    len += n;
+    if (len == m_buf.size()) {
+      m_buf.resize(m_buf.size() * 2);
+    }
+  }
+  close(fd);
+  m_buf.resize(len);
+  return parse(columns);
+}
+
+
+bool hs::stats_file::parse(const char *data, size_t len, int columns)
+{
+  m_names.clear();
+  m_buf.assign(data, data + len);
+  return parse(columns);
+}
+
+
+bool hs::stats_file::parse(int columns)
+{
+  m_columns = columns;
+  m_error.clear();
+  if (m_buf.empty()) {
+    m_rows = 0;
+    return true;
+  }
+
+  const char *b = &m_buf[0];
+  const char *e = b + m_buf.size();
+
+  size_t lines = 0;
+  for (const char *p = b; p < e; ++lines) {
+    const char *nl = static_cast<const char *>(memchr(p, '\n', e - p));
+    p = nl ? nl + 1 : e;
+  }
+  m_rows = lines;
+  m_values.resize(m_rows * columns);
+  m_names.reserve(m_rows);
+
+  bool header = true;
+  size_t row = 0;
+  for (const char *ls = b; ls < e;) {
+    const char *le = static_cast<const char *>(memchr(ls, '\n', e - ls));
+    if (!le) le = e;
+
+    const char *p = ls;
+    const char *tab = static_cast<const char *>(memchr(p, '\t', le - p));
+    if (tab && !header) {
+      m_names.push_back(make_pair(static_cast<uint32_t>(ls - b),
+                                  static_cast<uint32_t>(tab - ls)));
+    }
+
+    int col = 0;
+    const char *bad = nullptr;
+    const char *bad_end = nullptr;
+    while (tab && col < columns) {
+      p = tab + 1;
+      tab = static_cast<const char *>(memchr(p, '\t', le - p));
+      const char *ce = tab ? tab : le;
+      if (!header && !bad && !parse_double(p, ce, &m_values[col * m_rows + row])) {
+        bad = p;
+        bad_end = ce;
+      }
+      ++col;
+    }
+
+    if (col == columns) {
+      if (header) {
+        header = false;
+      } else if (bad) {
+        m_error = "invalid number: " + string(bad, bad_end);
+        m_names.clear();
+        return false;
+      } else {
+        ++row;
+      }
+    } else if (m_names.size() > row) {
+      m_names.pop_back(); // short line
+    }
+    ls = le + 1;
+  }
+  return true;
+}
@@ -0,0 +1,91 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats File Reader @file
+
+#ifndef hindsight_admin_stats_file_h_
+#define hindsight_admin_stats_file_h_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/utility/string_ref.hpp>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Columnar reader for the hindsight TSV stats files (name column followed by
+ * numeric columns, one header line). The file is read with a single bulk
+ * read, lines and cells are located with memchr and the numbers are parsed in
+ * place; names are returned as views into the read buffer. All storage is
+ * reused across loads so a steady state reload does not allocate.
+ */
+class stats_file {
+public:
+  stats_file();
+
+  /**
+   * Reads and parses the file.
+   *
+   * @param fn Path of the TSV file
+   * @param columns Number of numeric columns following the name, lines with
+   *                fewer cells are ignored
+   *
+   * @return bool False if the file could not be read or contains an invalid
+   *         number (see error())
+   */
+  bool load(const boost::filesystem::path &fn, int columns);
+
+  /**
+   * Parses an in memory copy of a stats file (the buffer is copied).
+   */
+  bool parse(const char *data, size_t len, int columns);
+
+  size_t rows() const { return m_names.size(); }
+  int columns() const { return m_columns; }
+
+  boost::string_ref name(size_t row) const
+  {
+    return boost::string_ref(&m_buf[m_names[row].first], m_names[row].second);
+  }
+
+  double value(size_t row, int col) const { return m_values[col * m_rows + row]; }
+  const double* column(int col) const { return &m_values[col * m_rows]; }
+
+  const std::string& error() const { return m_error; }
+
+private:
+  bool parse(int columns);
+
+  std::vector<char>                         m_buf;
+  std::vector<std::pair<uint32_t, uint32_t> > m_names;  // offset, length
+  std::vector<double>                       m_values; // column major
+  size_t                                    m_rows;   // allocated column height
+  int                                       m_columns;
+  std::string                               m_error;
+};
+
+/**
+ * Parses a decimal number without allocating or consulting the locale; falls
+ * back to strtod for exponents and other uncommon forms.
+ *
+ * @param p Start of the number
+ * @param e One past the end of the number
+ * @param d Receives the value
+ *
+ * @return bool False if [p, e) is not entirely a number
+ */
+bool parse_double(const char *p, const char *e, double *d);
+
+}
+}
+}
+#endif
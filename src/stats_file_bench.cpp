@@ -0,0 +1,176 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Stats File Reader Microbenchmark @file
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "stats_collector.h"
+#include "stats_file.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+static const int g_columns = hs::plugin_stats::columns;
+
+
+/**
+ * Writes a plugins.tsv shaped like the one hindsight produces.
+ */
+static void
+generate(const fs::path &fn, int rows)
+{
+  static const char *types[] = { "input", "analysis", "output" };
+  ofstream ofs(fn.string().c_str());
+  ofs << "Plugin";
+  for (int col = 0; col < g_columns; ++col) {
+    ofs << "\tColumn" << col;
+  }
+  ofs << "\n";
+
+  srand(rows);
+  for (int i = 0; i < rows; ++i) {
+    ofs << types[i % 3] << ".plugin_" << i;
+    for (int col = 0; col < g_columns; ++col) {
+      switch (col % 3) {
+      case 0:
+        ofs << "\t" << rand();
+        break;
+      case 1:
+        ofs << "\t" << rand() % 1000 << "." << rand() % 1000;
+        break;
+      default:
+        ofs << "\t" << rand() % 10;
+        break;
+      }
+    }
+    ofs << "\n";
+  }
+}
+
+
+/**
+ * The parse path the stats collector used before stats_file.
+ */
+static size_t
+parse_stream(const fs::path &fn, double *sum)
+{
+  bool header = true;
+  string s;
+  ifstream ifs(fn.string().c_str());
+  vector<string> cols;
+  size_t rows = 0;
+
+  while (getline(ifs, s).good()) {
+    boost::split(cols, s, boost::is_any_of("\t"));
+    if (cols.size() <= static_cast<size_t>(g_columns)) continue;
+
+    if (header) {
+      header = false;
+      continue;
+    }
+
+    hs::plugin_stats ps;
+    size_t pos = cols[0].find_first_of(".");
+    ps.type = cols[0].substr(0, pos);
+    ps.name = cols[0].substr(pos + 1);
+    for (int col = 0; col < g_columns; ++col) {
+      ps.values[col] = boost::lexical_cast<double>(cols[col + 1]);
+      *sum += ps.values[col];
+    }
+    ++rows;
+  }
+  return rows;
+}
+
+
+static size_t
+parse_columnar(hs::stats_file &sf, const fs::path &fn, double *sum)
+{
+  if (!sf.load(fn, g_columns)) {
+    fprintf(stderr, "%s\n", sf.error().c_str());
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < sf.rows(); ++i) {
+    boost::string_ref plugin = sf.name(i);
+    size_t pos = plugin.find('.');
+    hs::plugin_stats ps;
+    ps.type = plugin.substr(0, pos).to_string();
+    ps.name = plugin.substr(pos + 1).to_string();
+    for (int col = 0; col < g_columns; ++col) {
+      ps.values[col] = sf.value(i, col);
+      *sum += ps.values[col]; // row order, as the stream path sums
+    }
+  }
+  return sf.rows();
+}
+
+
+template<typename F>
+static double
+time_ms(int iterations, F f)
+{
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int rows = argc > 1 ? atoi(argv[1]) : 10000;
+  int iterations = argc > 2 ? atoi(argv[2]) : 20;
+  if (rows <= 0 || iterations <= 0) {
+    fprintf(stderr, "usage: %s [rows] [iterations]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  fs::path fn = fs::temp_directory_path() / fs::unique_path("plugins-%%%%%%%%.tsv");
+  generate(fn, rows);
+
+  double stream_sum = 0;
+  double columnar_sum = 0;
+  size_t stream_rows = 0;
+  size_t columnar_rows = 0;
+  hs::stats_file sf;
+  // warm the page cache and the reused stats_file buffers
+  parse_stream(fn, &stream_sum);
+  parse_columnar(sf, fn, &columnar_sum);
+
+  stream_sum = columnar_sum = 0;
+  double stream_ms = time_ms(iterations, [&]() {
+    stream_rows = parse_stream(fn, &stream_sum);
+  });
+  double columnar_ms = time_ms(iterations, [&]() {
+    columnar_rows = parse_columnar(sf, fn, &columnar_sum);
+  });
+  fs::remove(fn);
+
+  printf("rows: %d columns: %d iterations: %d\n", rows, g_columns, iterations);
+  printf("getline/split/lexical_cast: %8.3f ms\n", stream_ms);
+  printf("stats_file:                 %8.3f ms (%.1fx)\n", columnar_ms,
+         stream_ms / columnar_ms);
+  if (stream_rows != columnar_rows || stream_sum != columnar_sum) {
+    fprintf(stderr, "results differ: rows %zu/%zu sum %.17g/%.17g\n", stream_rows,
+            columnar_rows, stream_sum, columnar_sum);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
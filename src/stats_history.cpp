@@ -0,0 +1,167 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Plugin Stats History Implementation @file
+
+#include "stats_history.h"
+
+#include <cmath>
+#include <limits>
+
+#include "stats_collector.h"
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+
+static const uint64_t g_never = numeric_limits<uint64_t>::max();
+static const uint32_t g_no_slot = numeric_limits<uint32_t>::max();
+
+// plugins.tsv column and display scale of each tracked counter
+static const int g_column[] = { 0, 2, 3 };
+static const double g_scale[] = { 1, 1, 60 }; // failures are shown per minute
+
+static const char *g_bars[] = {
+  "\xe2\x96\x81", "\xe2\x96\x82", "\xe2\x96\x83", "\xe2\x96\x84",
+  "\xe2\x96\x85", "\xe2\x96\x86", "\xe2\x96\x87", "\xe2\x96\x88"
+};
+
+
+hs::stats_history::stats_history(size_t max_plugins) :
+    m_max_plugins(max_plugins),
+    m_sample(0),
+    m_rates(max_plugins * counters * trend_length, NAN),
+    m_last(max_plugins * counters, 0),
+    m_last_seen(max_plugins, g_never)
+{
+  for (int i = 0; i < trend_length; ++i) {
+    m_times[i] = 0;
+  }
+  m_free.reserve(max_plugins);
+  for (size_t i = max_plugins; i > 0; --i) {
+    m_free.push_back(static_cast<uint32_t>(i - 1));
+  }
+  m_slots.reserve(max_plugins);
+}
+
+
+void hs::stats_history::add(double t, plugins_snapshot &snapshot)
+{
+  const uint64_t s = m_sample;
+  const int pos = s % trend_length;
+  double dt = 0;
+  if (s > 0) {
+    dt = t - m_times[(s - 1) % trend_length];
+  }
+
+  for (auto it = snapshot.rows.begin(); it != snapshot.rows.end(); ++it) {
+    for (int c = 0; c < counters; ++c) {
+      it->rate[c] = NAN;
+    }
+    uint32_t slot = find_slot(it->type + "." + it->name);
+    if (slot == g_no_slot) {
+      continue; // history is full of plugins active in this sample
+    }
+
+    uint64_t seen = m_last_seen[slot];
+    if (seen == s) {
+      continue; // duplicate row
+    }
+    bool contiguous = seen != g_never && seen + 1 == s && dt > 0;
+    if (seen != g_never && seen + 1 < s) {
+      // the plugin was missing from the intervening samples
+      uint64_t gap = s - seen - 1;
+      if (gap > static_cast<uint64_t>(trend_length)) gap = trend_length;
+      for (int c = 0; c < counters; ++c) {
+        float *r = ring(slot, c);
+        for (uint64_t k = s - gap; k < s; ++k) {
+          r[k % trend_length] = NAN;
+        }
+      }
+    }
+
+    for (int c = 0; c < counters; ++c) {
+      double v = it->values[g_column[c]];
+      double &last = m_last[slot * counters + c];
+      float rate = NAN;
+      if (contiguous) {
+        double delta = v - last;
+        if (delta < 0) delta = v; // the plugin was restarted
+        rate = static_cast<float>(delta / dt);
+        it->rate[c] = round(rate * g_scale[c] * 100) / 100;
+      }
+      ring(slot, c)[pos] = rate;
+      last = v;
+    }
+    m_last_seen[slot] = s;
+    fill_trend(slot, it->type == "input" ? im_count : pm_count, it->trend);
+  }
+
+  m_times[pos] = t;
+  ++m_sample;
+}
+
+
+uint32_t hs::stats_history::find_slot(const string &key)
+{
+  auto it = m_slots.find(key);
+  if (it != m_slots.end()) {
+    return it->second;
+  }
+
+  uint32_t slot;
+  if (!m_free.empty()) {
+    slot = m_free.back();
+    m_free.pop_back();
+  } else {
+    auto lru = m_slots.end();
+    for (auto si = m_slots.begin(); si != m_slots.end(); ++si) {
+      if (lru == m_slots.end() || m_last_seen[si->second] < m_last_seen[lru->second]) {
+        lru = si;
+      }
+    }
+    if (lru == m_slots.end() || m_last_seen[lru->second] == m_sample) {
+      return g_no_slot;
+    }
+    slot = lru->second;
+    m_slots.erase(lru);
+  }
+
+  for (int c = 0; c < counters; ++c) {
+    float *r = ring(slot, c);
+    for (int i = 0; i < trend_length; ++i) {
+      r[i] = NAN;
+    }
+  }
+  m_last_seen[slot] = g_never;
+  m_slots[key] = slot;
+  return slot;
+}
+
+
+void hs::stats_history::fill_trend(uint32_t slot, int c, string &trend) const
+{
+  uint64_t n = m_sample + 1;
+  if (n > static_cast<uint64_t>(trend_length)) n = trend_length;
+
+  const float *r = ring(slot, c);
+  float max = 0;
+  for (uint64_t k = m_sample + 1 - n; k <= m_sample; ++k) {
+    float v = r[k % trend_length];
+    if (v > max) max = v; // NaN compares false
+  }
+
+  trend.clear();
+  for (uint64_t k = m_sample + 1 - n; k <= m_sample; ++k) {
+    float v = r[k % trend_length];
+    if (std::isnan(v)) {
+      trend += ' ';
+    } else if (max > 0) {
+      trend += g_bars[static_cast<int>(v / max * 7 + 0.5f)];
+    } else {
+      trend += g_bars[0];
+    }
+  }
+}
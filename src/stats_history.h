@@ -0,0 +1,76 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Plugin Stats History @file
+
+#ifndef hindsight_admin_stats_history_h_
+#define hindsight_admin_stats_history_h_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+struct plugins_snapshot;
+
+/**
+ * Fixed size, preallocated ring buffers of the per plugin message and failure
+ * rates derived from the cumulative plugins.tsv counters, one trend sparkline
+ * deep. Storage is max_plugins * counters * trend_length floats; when full the
+ * least recently seen plugin is evicted.
+ */
+class stats_history {
+public:
+  static const int trend_length = 20;
+
+  enum counter {
+    im_count,
+    pm_count,
+    pm_failures,
+    counters
+  };
+
+  stats_history(size_t max_plugins = 10240);
+
+  /**
+   * Records a sample for every row of the snapshot and fills in the row's
+   * derived rates and trend sparkline.
+   *
+   * @param t Sample time (monotonic seconds)
+   * @param snapshot Newly parsed, not yet published, snapshot
+   */
+  void add(double t, plugins_snapshot &snapshot);
+
+private:
+  uint32_t find_slot(const std::string &key);
+  float* ring(uint32_t slot, int c)
+  {
+    return &m_rates[(slot * counters + c) * trend_length];
+  }
+  const float* ring(uint32_t slot, int c) const
+  {
+    return &m_rates[(slot * counters + c) * trend_length];
+  }
+  void fill_trend(uint32_t slot, int c, std::string &trend) const;
+
+  size_t                                    m_max_plugins;
+  uint64_t                                  m_sample;
+  double                                    m_times[trend_length];
+  std::vector<float>                        m_rates;      // slot, counter, ring
+  std::vector<double>                       m_last;       // slot, counter
+  std::vector<uint64_t>                     m_last_seen;  // slot -> sample
+  std::vector<uint32_t>                     m_free;
+  std::unordered_map<std::string, uint32_t> m_slots;
+};
+
+}
+}
+}
+#endif
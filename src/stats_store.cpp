@@ -0,0 +1,533 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats Store Implementation @file
+
+#include "stats_store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Wt/WLogger>
+
+using namespace std;
+namespace hs = mozilla::services::hindsight;
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct file_header {
+  char      magic[4];
+  uint16_t  columns;
+  uint16_t  type;         // 0 raw, 1 + resolution
+  uint32_t  record_size;
+  uint32_t  reserved;
+};
+
+struct rollup_key {
+  int64_t   time;
+  uint32_t  count;
+  uint32_t  id;
+  uint32_t  block_size;   // records in the bucket block
+  uint32_t  block_pos;    // of the record in the block
+};
+
+const char      g_magic[4]      = { 'H', 'S', 'S', '1' };
+const int64_t   g_seconds[]     = { 60, 3600 };
+const char     *g_rollup_dir[]  = { "1m", "1h" };
+const char     *g_period[]      = { "%Y%m%d", "%Y%m" }; // of a rollup file
+const char     *g_day           = "%Y%m%d";
+const int64_t   g_minute_days   = 14;
+const size_t    g_record_header = 16; // time, id, reserved
+
+size_t raw_size(int columns)
+{
+  return g_record_header + columns * sizeof(float);
+}
+
+
+size_t rollup_size(int columns)
+{
+  return sizeof(rollup_key) + 3 * columns * sizeof(float);
+}
+
+
+rollup_key read_key(const char *r)
+{
+  rollup_key k;
+  memcpy(&k, r, sizeof k);
+  return k;
+}
+
+
+string period_name(int64_t t, const char *format)
+{
+  time_t tt = t;
+  struct tm tm;
+  gmtime_r(&tt, &tm);
+  char buf[16];
+  strftime(buf, sizeof buf, format, &tm);
+  return buf;
+}
+
+
+void prune_dir(const fs::path &dir, const string &cutoff)
+{
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(dir, ec); !ec && it != fs::directory_iterator(); ++it) {
+    if (it->path().filename().string() < cutoff) {
+      fs::remove(it->path(), ec);
+    }
+  }
+}
+
+
+/**
+ * Appends whole records to a store file, writing the header to a new file. A
+ * partial record left by a crash is zero padded (count 0 records are skipped
+ * by the reader) rather than truncated as a reader may have it mapped.
+ */
+bool append(const fs::path &fn, const file_header &hdr, const char *data, size_t len)
+{
+  int fd = open(fn.string().c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    Wt::log("error") << "stats_store open failed: " << fn.string() << " " << strerror(errno);
+    return false;
+  }
+
+  bool ok = true;
+  struct stat st;
+  off_t pos = 0;
+  if (fstat(fd, &st)) {
+    ok = false;
+  } else if (st.st_size < static_cast<off_t>(sizeof hdr)) {
+    ok = pwrite(fd, &hdr, sizeof hdr, 0) == sizeof hdr;
+    pos = sizeof hdr;
+  } else {
+    pos = st.st_size;
+    off_t partial = (pos - sizeof hdr) % hdr.record_size;
+    if (partial) {
+      vector<char> pad(hdr.record_size - partial, 0);
+      uint32_t count = 0;
+      ok = pwrite(fd, &pad[0], pad.size(), pos) == static_cast<ssize_t>(pad.size())
+          && pwrite(fd, &count, sizeof count, pos - partial + 8) == sizeof count;
+      pos += pad.size();
+    }
+  }
+
+  if (ok) {
+    ok = pwrite(fd, data, len, pos) == static_cast<ssize_t>(len);
+  }
+  if (!ok) {
+    Wt::log("error") << "stats_store write failed: " << fn.string() << " " << strerror(errno);
+  }
+  close(fd);
+  return ok;
+}
+
+
+/**
+ * Appends the rollups of one series found in a period file. The blocks are in
+ * time order so the first one is bisected and each block is bisected for the
+ * series id.
+ */
+bool read_rollups(const fs::path &fn, int columns, int type, uint32_t id, int column,
+                  int64_t from, int64_t to, vector<hs::stats_store::point> &points)
+{
+  int fd = open(fn.string().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno == ENOENT;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < static_cast<off_t>(sizeof(file_header))) {
+    close(fd);
+    return true;
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    Wt::log("error") << "stats_store mmap failed: " << fn.string() << " " << strerror(errno);
+    return false;
+  }
+
+  const char *base = static_cast<const char *>(map);
+  file_header hdr;
+  memcpy(&hdr, base, sizeof hdr);
+  size_t rs = rollup_size(columns);
+  if (memcmp(hdr.magic, g_magic, sizeof g_magic) || hdr.columns != columns
+      || hdr.type != type || hdr.record_size != rs) {
+    Wt::log("error") << "stats_store invalid file: " << fn.string();
+    munmap(map, size);
+    return false;
+  }
+
+  const char *records = base + sizeof hdr;
+  size_t n = (size - sizeof hdr) / rs;
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (read_key(records + mid * rs).time < from) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (size_t i = lo; i < n;) {
+    rollup_key k = read_key(records + i * rs);
+    if (k.time > to) break;
+    size_t end = i + k.block_size;
+    if (k.block_pos != 0 || k.block_size == 0 || end > n) {
+      ++i; // the zero padding of a partial record
+      continue;
+    }
+    rollup_key last = read_key(records + (end - 1) * rs);
+    if (last.time != k.time || last.block_size != k.block_size
+        || last.block_pos != k.block_size - 1) {
+      ++i; // a block cut short by a crash
+      continue;
+    }
+
+    size_t b = i, e = end;
+    while (b < e) {
+      size_t mid = b + (e - b) / 2;
+      if (read_key(records + mid * rs).id < id) {
+        b = mid + 1;
+      } else {
+        e = mid;
+      }
+    }
+    i = end;
+    if (b == end) continue;
+    const char *r = records + b * rs;
+    k = read_key(r);
+    if (k.id != id || k.count == 0) continue;
+
+    hs::stats_store::point p;
+    p.time = k.time;
+    p.count = k.count;
+    const char *v = r + sizeof(rollup_key) + column * sizeof(float);
+    memcpy(&p.min, v, sizeof(float));
+    memcpy(&p.max, v + columns * sizeof(float), sizeof(float));
+    memcpy(&p.avg, v + 2 * columns * sizeof(float), sizeof(float));
+
+    if (!points.empty() && points.back().time == p.time) {
+      // a bucket split across a restart
+      hs::stats_store::point &pb = points.back();
+      uint32_t count = pb.count + p.count;
+      pb.avg = (pb.avg * pb.count + p.avg * p.count) / count;
+      pb.count = count;
+      if (p.min < pb.min) pb.min = p.min;
+      if (p.max > pb.max) pb.max = p.max;
+    } else {
+      points.push_back(p);
+    }
+  }
+  munmap(map, size);
+  return true;
+}
+
+}
+
+
+hs::stats_store::stats_store(const string &source, int columns, int raw_days) :
+    m_source(source),
+    m_columns(columns),
+    m_raw_days(raw_days),
+    m_open(false),
+    m_raw_day(-1) { }
+
+
+hs::stats_store::~stats_store()
+{
+  close();
+  for (auto it = m_series.begin(); it != m_series.end(); ++it) {
+    delete *it;
+  }
+}
+
+
+bool hs::stats_store::open(const fs::path &root)
+{
+  m_dir = root / m_source;
+  try {
+    fs::create_directories(m_dir / "raw");
+    for (int r = 0; r < resolutions; ++r) {
+      fs::create_directories(m_dir / g_rollup_dir[r]);
+    }
+  } catch (fs::filesystem_error &e) {
+    Wt::log("error") << "stats_store disabled: " << e.what();
+    return false;
+  }
+
+  ifstream ifs((m_dir / "series.tsv").string());
+  string line;
+  while (getline(ifs, line)) {
+    size_t pos = line.find('\t');
+    if (pos == string::npos) continue;
+    uint32_t id = strtoul(line.c_str(), nullptr, 10);
+    string name = line.substr(pos + 1);
+    if (id >= m_series.size()) {
+      m_series.resize(id + 1, nullptr);
+    }
+    lock_guard<mutex> lock(m_mutex);
+    m_ids[name] = id;
+  }
+  for (uint32_t id = 0; id < m_series.size(); ++id) {
+    if (!m_series[id]) {
+      m_series[id] = new_series(id);
+    }
+  }
+  m_open = true;
+  return true;
+}
+
+
+void hs::stats_store::close()
+{
+  if (!m_open) return;
+  for (auto it = m_series.begin(); it != m_series.end(); ++it) {
+    for (int r = 0; r < resolutions; ++r) {
+      if ((*it)->buckets[r].count) {
+        flush(**it, static_cast<resolution>(r));
+      }
+    }
+  }
+  for (int r = 0; r < resolutions; ++r) {
+    write_rollups(static_cast<resolution>(r));
+  }
+  m_open = false;
+}
+
+
+void hs::stats_store::add(int64_t t, const string &series, const float *values)
+{
+  if (!m_open) return;
+  series_state *s = find_create(series);
+  if (!s) return;
+
+  size_t off = m_raw.size();
+  m_raw.resize(off + raw_size(m_columns));
+  char *r = &m_raw[off];
+  uint32_t reserved = 0;
+  memcpy(r, &t, sizeof t);
+  memcpy(r + 8, &s->id, sizeof s->id);
+  memcpy(r + 12, &reserved, sizeof reserved);
+  memcpy(r + g_record_header, values, m_columns * sizeof(float));
+
+  for (int i = 0; i < resolutions; ++i) {
+    bucket &b = s->buckets[i];
+    int64_t start = t - t % g_seconds[i];
+    if (b.count && b.start != start) {
+      flush(*s, static_cast<resolution>(i));
+    }
+    if (b.count == 0) {
+      b.start = start;
+      for (int c = 0; c < m_columns; ++c) {
+        b.min[c] = b.max[c] = values[c];
+        b.sum[c] = values[c];
+      }
+    } else {
+      for (int c = 0; c < m_columns; ++c) {
+        if (values[c] < b.min[c]) b.min[c] = values[c];
+        if (values[c] > b.max[c]) b.max[c] = values[c];
+        b.sum[c] += values[c];
+      }
+    }
+    ++b.count;
+  }
+}
+
+
+void hs::stats_store::commit(int64_t t)
+{
+  if (!m_open) return;
+
+  if (!m_raw.empty()) {
+    file_header hdr = { { g_magic[0], g_magic[1], g_magic[2], g_magic[3] },
+      static_cast<uint16_t>(m_columns), 0,
+      static_cast<uint32_t>(raw_size(m_columns)), 0 };
+    append(m_dir / "raw" / period_name(t, g_day), hdr, &m_raw[0], m_raw.size());
+    m_raw.clear();
+  }
+  if (t / 86400 != m_raw_day) {
+    m_raw_day = t / 86400;
+    prune(t);
+  }
+
+  for (auto it = m_series.begin(); it != m_series.end(); ++it) {
+    for (int r = 0; r < resolutions; ++r) {
+      bucket &b = (*it)->buckets[r];
+      if (b.count && b.start + g_seconds[r] <= t) {
+        flush(**it, static_cast<resolution>(r));
+      }
+    }
+  }
+  for (int r = 0; r < resolutions; ++r) {
+    write_rollups(static_cast<resolution>(r));
+  }
+}
+
+
+bool hs::stats_store::read(const string &series, resolution r, int column, int64_t from,
+                           int64_t to, vector<point> &points) const
+{
+  points.clear();
+  if (column < 0 || column >= m_columns) {
+    return false;
+  }
+
+  uint32_t id;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_ids.find(series);
+    if (it == m_ids.end()) {
+      return false;
+    }
+    id = it->second;
+  }
+
+  // a period file holds the buckets starting in its period
+  const string first = period_name(from, g_period[r]);
+  const string last = period_name(to, g_period[r]);
+  vector<fs::path> files;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(m_dir / g_rollup_dir[r], ec);
+       !ec && it != fs::directory_iterator(); it.increment(ec)) {
+    string name = it->path().filename().string();
+    if (name >= first && name <= last) {
+      files.push_back(it->path());
+    }
+  }
+  sort(files.begin(), files.end());
+  for (auto it = files.begin(); it != files.end(); ++it) {
+    if (!read_rollups(*it, m_columns, 1 + r, id, column, from, to, points)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+hs::stats_store::series_state* hs::stats_store::find_create(const string &name)
+{
+  auto it = m_ids.find(name); // the writer is the only thread modifying m_ids
+  if (it != m_ids.end()) {
+    return m_series[it->second];
+  }
+
+  uint32_t id = m_series.size();
+  ofstream ofs((m_dir / "series.tsv").string(), ios_base::app);
+  ofs << id << "\t" << name << "\n";
+  if (!ofs.flush()) {
+    Wt::log("error") << "stats_store could not add series: " << name;
+    return nullptr;
+  }
+
+  series_state *s = new_series(id);
+  m_series.push_back(s);
+  lock_guard<mutex> lock(m_mutex);
+  m_ids[name] = id;
+  return s;
+}
+
+
+hs::stats_store::series_state* hs::stats_store::new_series(uint32_t id) const
+{
+  series_state *s = new series_state();
+  s->id = id;
+  for (int r = 0; r < resolutions; ++r) {
+    bucket &b = s->buckets[r];
+    b.start = 0;
+    b.count = 0;
+    b.min.resize(m_columns);
+    b.max.resize(m_columns);
+    b.sum.resize(m_columns);
+  }
+  return s;
+}
+
+
+void hs::stats_store::flush(series_state &s, resolution r)
+{
+  bucket &b = s.buckets[r];
+  vector<char> &pending = m_rollups[r];
+  size_t off = pending.size();
+  pending.resize(off + rollup_size(m_columns));
+  char *p = &pending[off];
+  rollup_key k = { b.start, b.count, s.id, 0, 0 };
+  memcpy(p, &k, sizeof k);
+  float *v = reinterpret_cast<float *>(p + sizeof k);
+  for (int c = 0; c < m_columns; ++c) {
+    v[c] = b.min[c];
+    v[m_columns + c] = b.max[c];
+    v[2 * m_columns + c] = static_cast<float>(b.sum[c] / b.count);
+  }
+  b.count = 0;
+}
+
+
+void hs::stats_store::write_rollups(resolution r)
+{
+  vector<char> &pending = m_rollups[r];
+  if (pending.empty()) return;
+
+  const size_t rs = rollup_size(m_columns);
+  const size_t n = pending.size() / rs;
+  vector<pair<pair<int64_t, uint32_t>, size_t> > order(n); // (start, id), record
+  for (size_t i = 0; i < n; ++i) {
+    rollup_key k = read_key(&pending[i * rs]);
+    order[i] = make_pair(make_pair(k.time, k.id), i);
+  }
+  sort(order.begin(), order.end());
+
+  m_block.resize(pending.size());
+  for (size_t i = 0; i < n;) {
+    size_t end = i + 1;
+    while (end < n && order[end].first.first == order[i].first.first) ++end;
+    for (size_t j = i; j < end; ++j) {
+      char *p = &m_block[j * rs];
+      memcpy(p, &pending[order[j].second * rs], rs);
+      rollup_key k = read_key(p);
+      k.block_size = static_cast<uint32_t>(end - i);
+      k.block_pos = static_cast<uint32_t>(j - i);
+      memcpy(p, &k, sizeof k);
+    }
+    i = end;
+  }
+  pending.clear();
+
+  file_header hdr = { { g_magic[0], g_magic[1], g_magic[2], g_magic[3] },
+    static_cast<uint16_t>(m_columns), static_cast<uint16_t>(1 + r),
+    static_cast<uint32_t>(rs), 0 };
+  size_t begin = 0;
+  string name = period_name(order[0].first.first, g_period[r]);
+  for (size_t i = 1; i <= n; ++i) {
+    if (i < n && order[i].first.first == order[i - 1].first.first) continue;
+    string next = i < n ? period_name(order[i].first.first, g_period[r]) : string();
+    if (next != name) {
+      append(m_dir / g_rollup_dir[r] / name, hdr, &m_block[begin * rs], (i - begin) * rs);
+      begin = i;
+      name = next;
+    }
+  }
+}
+
+
+void hs::stats_store::prune(int64_t t)
+{
+  prune_dir(m_dir / "raw", period_name(t - static_cast<int64_t>(m_raw_days) * 86400, g_day));
+  prune_dir(m_dir / g_rollup_dir[minute],
+            period_name(t - g_minute_days * 86400, g_period[minute]));
+}
@@ -0,0 +1,142 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Hindsight Stats Store @file
+
+#ifndef hindsight_admin_stats_store_h_
+#define hindsight_admin_stats_store_h_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace mozilla {
+namespace services {
+namespace hindsight {
+
+/**
+ * Append only on disk history of one stats source (plugins or utilization).
+ *
+ * Layout under <root>/<source>/:
+ *   series.tsv      series id to name dictionary
+ *   raw/YYYYMMDD    every sample of every series (pruned after raw_days)
+ *   1m/YYYYMMDD     one minute min/max/avg rollups of every series (pruned
+ *                   after 14 days)
+ *   1h/YYYYMM       one hour min/max/avg rollups of every series
+ *
+ * All files are a fixed header followed by fixed size records and are never
+ * truncated in place so they can be safely read through mmap while being
+ * appended to. The rollups are accumulated in memory and appended when their
+ * bucket closes, all the series of a bucket as one block sorted by series id.
+ * A commit appends to at most one file per resolution and charting a week of
+ * one series bisects ~168 hourly blocks.
+ */
+class stats_store {
+public:
+  enum resolution {
+    minute,
+    hour,
+    resolutions
+  };
+
+  struct point {
+    int64_t   time;
+    uint32_t  count;
+    float     min;
+    float     max;
+    float     avg;
+  };
+
+  stats_store(const std::string &source, int columns, int raw_days = 2);
+  ~stats_store();
+
+  /**
+   * Creates the store directory and loads the series dictionary; the store
+   * is disabled (all calls are no-ops) if this fails.
+   */
+  bool open(const boost::filesystem::path &root);
+
+  /**
+   * Flushes the partially filled rollup buckets.
+   */
+  void close();
+
+  /**
+   * Adds one series sample; the samples of a parse must share the time and be
+   * followed by a commit.
+   *
+   * @param t Sample time (seconds since the epoch)
+   * @param series Series name
+   * @param values Array of columns values
+   */
+  void add(int64_t t, const std::string &series, const float *values);
+
+  /**
+   * Writes the raw samples added since the last commit and appends the
+   * rollups of the buckets that closed before t.
+   */
+  void commit(int64_t t);
+
+  /**
+   * Reads one column of the rollups of a series.
+   *
+   * @param series Series name
+   * @param r Rollup resolution
+   * @param column Column index
+   * @param from Start time (inclusive)
+   * @param to End time (inclusive)
+   * @param points Receives the points in time order
+   *
+   * @return bool False if the series is unknown or unreadable
+   */
+  bool read(const std::string &series, resolution r, int column, int64_t from,
+            int64_t to, std::vector<point> &points) const;
+
+  int columns() const { return m_columns; }
+
+private:
+  struct bucket {
+    int64_t             start;
+    uint32_t            count;
+    std::vector<float>  min;
+    std::vector<float>  max;
+    std::vector<double> sum;
+  };
+
+  struct series_state {
+    uint32_t  id;
+    bucket    buckets[resolutions];
+  };
+
+  series_state* find_create(const std::string &name);
+  series_state* new_series(uint32_t id) const;
+  void flush(series_state &s, resolution r);
+  void write_rollups(resolution r);
+  void prune(int64_t t);
+
+  std::string             m_source;
+  int                     m_columns;
+  int                     m_raw_days;
+  boost::filesystem::path m_dir;
+  bool                    m_open;
+  int64_t                 m_raw_day;
+  std::vector<char>       m_raw;            // pending raw records
+  std::vector<char>       m_rollups[resolutions]; // closed buckets pending
+  std::vector<char>       m_block;          // sorted rollup scratch space
+  std::vector<series_state *> m_series;     // by id, writer only
+
+  mutable std::mutex                        m_mutex; // m_ids
+  std::unordered_map<std::string, uint32_t> m_ids;
+};
+
+}
+}
+}
+#endif
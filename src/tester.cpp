@@ -112,28 +112,35 @@ void hs::tester::disable_deploy()
 
 void hs::tester::run_matcher()
 {
-  m_msgs->clear();
+  m_msgs->set_messages(nullptr);
   m_injected->clear();
   m_debug->clear();
+  m_inputs.reset();
   string err_msg;
-  m_inputs_cnt = hs::run_matcher(m_hs_cfg->m_hs_output,
-                                 m_cfg->text().toUTF8(),
-                                 m_session->get_user_name(),
-                                 m_msgs,
-                                 m_inputs, g_max_messages,
-                                 &err_msg);
-  if (m_inputs_cnt == 0) {
-    Wt::WText *t = new Wt::WText(m_debug);
-    if (err_msg.empty()) {
-      t->setText(tr("no_matches"));
-    } else {
-      t->setText(err_msg);
-    }
+  if (!hs::run_matcher(m_job,
+                       m_services->matchers,
+                       m_hs_cfg->m_hs_output,
+                       m_cfg->text().toUTF8(),
+                       m_session->get_user_name(),
+                       m_hs_cfg->m_max_message_size,
+                       selected_queues(m_queues),
+                       m_samples->value(),
+                       [this](const shared_ptr<const scan_result> &r) { show_matches(r); },
+                       &err_msg)) {
+    Wt::WText *t = new Wt::WText(err_msg, m_debug);
     t->setStyleClass("result_error");
   }
 }
 
 
+void hs::tester::show_matches(const shared_ptr<const scan_result> &r)
+{
+  m_inputs = r;
+  m_msgs->set_messages(r);
+  hs::show_matches(*r, m_debug);
+}
+
+
 Wt::WWidget* hs::tester::message_matcher()
 {
   Wt::WContainerWidget *container = new Wt::WContainerWidget();
@@ -170,8 +177,11 @@ Wt::WWidget* hs::tester::message_matcher()
       );
   m_sandbox_sig = m_sandbox->textInput().connect(this, &tester::disable_deploy);
 
+  m_queues = queue_selector(container);
+  m_samples = sample_size_selector(container);
   Wt::WPushButton *button = new Wt::WPushButton(tr("run_matcher"), container);
   button->clicked().connect(this, &tester::run_matcher);
+  m_job = new scan_job(m_services, container);
 
   button = new Wt::WPushButton(tr("test_plugin"), container);
   button->clicked().connect(this, &tester::test_plugin);
@@ -191,7 +201,7 @@ Wt::WWidget* hs::tester::result()
   Wt::WText *t = new Wt::WText(tr("matched_messages"), c);
   t->setStyleClass("area_title");
 
-  m_msgs = new Wt::WContainerWidget(c);
+  m_msgs = new message_browser(c);
   m_msgs->setStyleClass("matcher_output");
 
   t = new Wt::WText(tr("debug_output"), c);
@@ -218,9 +228,8 @@ void hs::tester::test_plugin()
   m_logs = new Wt::WTextArea(m_debug);
 
   string err_msg;
-  lsb_message_matcher *mm = NULL;
-  lua_State *L = validate_cfg(m_cfg->text().toUTF8(), m_session->get_user_name(), &mm, &err_msg);
-  lsb_destroy_message_matcher(mm);
+  lua_State *L = validate_cfg(m_cfg->text().toUTF8(), m_session->get_user_name(),
+                              m_services->matchers, NULL, &err_msg);
   if (!L) {
     Wt::WText *t = new Wt::WText(err_msg, m_debug);
     t->setStyleClass("result_error");
@@ -281,14 +290,21 @@ void hs::tester::test_plugin()
 
   int rv = 0;
   hsb = lsb_heka_create_analysis(this, tmp.string().c_str(), NULL, cfg.str().c_str(), &logger, aim);
-  for (int i = 0; i < m_inputs_cnt; ++i) {
+  // one decoded message at a time; the sample can be thousands of messages
+  lsb_heka_message m;
+  lsb_init_heka_message(&m, 10);
+  size_t cnt = m_inputs ? m_inputs->messages.size() : 0;
+  for (size_t i = 0; i < cnt; ++i) {
+    const string &raw = m_inputs->messages[i];
+    if (!lsb_decode_heka_message(&m, raw.data(), raw.size(), NULL)) continue;
     m_im_limit = m_hs_cfg->m_pm_im_limit;
-    rv = lsb_heka_pm_analysis(hsb, &m_inputs[i].m, false);
+    rv = lsb_heka_pm_analysis(hsb, &m, false);
     if (rv != 0) {
       lcb(this, "", 7, "%s\n", lsb_heka_get_error(hsb));
       break;
     }
   }
+  lsb_free_heka_message(&m);
   if (rv <= 0) {
     m_im_limit = m_hs_cfg->m_te_im_limit;
     rv = lsb_heka_timer_event(hsb, time(NULL), true);
@@ -317,9 +333,8 @@ void hs::tester::deploy_plugin()
   m_debug->clear();
 
   string err_msg;
-  lsb_message_matcher *mm = NULL;
-  lua_State *L = validate_cfg(m_cfg->text().toUTF8(), m_session->get_user_name(), &mm, &err_msg);
-  lsb_destroy_message_matcher(mm);
+  lua_State *L = validate_cfg(m_cfg->text().toUTF8(), m_session->get_user_name(),
+                              m_services->matchers, NULL, &err_msg);
   if (!L) {
     Wt::WText *t = new Wt::WText(err_msg, m_debug);
     t->setStyleClass("result_error");
@@ -375,28 +390,14 @@ void hs::tester::deploy_plugin()
 }
 
 
-hs::tester::tester(hs::session *s, const hindsight_cfg *hs_cfg, hs::plugins *p) :
+hs::tester::tester(hs::session *s, const services *svc, hs::plugins *p) :
     m_im_limit(0),
     m_session(s),
-    m_hs_cfg(hs_cfg),
-    m_plugins(p),
-    m_inputs_cnt(0)
+    m_services(svc),
+    m_hs_cfg(svc->cfg),
+    m_plugins(p)
 {
   Wt::WHBoxLayout *hbox = new Wt::WHBoxLayout(this);
   hbox->addWidget(message_matcher(), 1);
   hbox->addWidget(result(), 1);
-
-  for (size_t i = 0; i < g_max_messages; ++i) {
-    lsb_init_input_buffer(&m_inputs[i].b, hs_cfg->m_max_message_size);
-    lsb_init_heka_message(&m_inputs[i].m, 10);
-  }
-}
-
-
-hs::tester::~tester()
-{
-  for (size_t i = 0; i < g_max_messages; ++i) {
-    lsb_free_heka_message(&m_inputs[i].m);
-    lsb_free_input_buffer(&m_inputs[i].b);
-  }
 }
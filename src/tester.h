@@ -9,6 +9,7 @@
 #ifndef hindsight_admin_tester_h_
 #define hindsight_admin_tester_h_
 
+#include <memory>
 #include <string>
 #include <sstream>
 
@@ -35,8 +36,7 @@ namespace hindsight {
 
 class tester : public Wt::WContainerWidget {
 public:
-  tester(session *s, const hindsight_cfg *hs_cfg, plugins *p);
-  ~tester();
+  tester(session *s, const services *svc, plugins *p);
   void output_message(lsb_heka_message *m, Wt::WTreeNode *root);
   void append_log(const char *s);
   int           m_im_limit;
@@ -47,13 +47,14 @@ private:
   void test_plugin();
   void deploy_plugin();
   void run_matcher();
+  void show_matches(const std::shared_ptr<const scan_result> &r);
   void disable_deploy();
   Wt::WWidget* message_matcher();
   void finalize();
   void message_box_dismissed();
-  std::string get_file_number();
 
   session             *m_session;
+  const services      *m_services;
   const hindsight_cfg *m_hs_cfg;
   plugins             *m_plugins;
   Wt::WMessageBox     *m_message_box;
@@ -62,7 +63,10 @@ private:
   // pointers managed by the container
   Wt::WTextArea         *m_cfg;
   Wt::WTextArea         *m_sandbox;
-  Wt::WContainerWidget  *m_msgs;
+  Wt::WComboBox         *m_queues;
+  Wt::WSpinBox          *m_samples;
+  scan_job              *m_job;
+  message_browser       *m_msgs;
   Wt::WContainerWidget  *m_debug;
   Wt::WContainerWidget  *m_injected;
   Wt::WTextArea         *m_logs;
@@ -70,8 +74,7 @@ private:
   // end managed pointers
   Wt::Signals::connection m_cfg_sig;
   Wt::Signals::connection m_sandbox_sig;
-  struct input_msg m_inputs[g_max_messages];
-  int m_inputs_cnt;
+  std::shared_ptr<const scan_result> m_inputs;
 };
 
 }
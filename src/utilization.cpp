@@ -8,15 +8,13 @@
 
 #include "utilization.h"
 
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <unordered_map>
 #include <vector>
 
-#include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/lexical_cast.hpp>
+#include <Wt/WApplication>
 #include <Wt/WStandardItem>
 
 #include "constants.h"
@@ -25,9 +23,11 @@ using namespace std;
 namespace hs = mozilla::services::hindsight;
 namespace fs = boost::filesystem;
 
-hs::utilization::utilization(hs::session *s, const hindsight_cfg *cfg) :
+hs::utilization::utilization(hs::session *s, const hindsight_cfg *cfg, stats_collector *stats) :
     m_session(s),
     m_hs_cfg(cfg),
+    m_collector(stats),
+    m_subscription(-1),
     m_stats(0, stat_columns)
 {
   m_stats.setHeaderData(0, Wt::Horizontal, tr("plugin_name"));
@@ -40,17 +40,16 @@ hs::utilization::utilization(hs::session *s, const hindsight_cfg *cfg) :
 }
 
 
-Wt::WStandardItem* hs::utilization::find_row(Wt::WStandardItem *parent, const string &name, int row)
+hs::utilization::~utilization()
 {
-  int rows = parent->rowCount();
-  for (; row < rows; ++row) {
-    Wt::WStandardItem *item = parent->child(row, 0);
-    string tmp(boost::any_cast<string>(item->data(Wt::DisplayRole)));
-    if (tmp == name) {
-      return item;
-    }
-  }
-  return nullptr;
+  m_collector->unsubscribe(m_subscription);
+}
+
+
+void hs::utilization::refresh()
+{
+  load_stats();
+  Wt::WApplication::instance()->triggerUpdate();
 }
 
 
@@ -70,36 +69,14 @@ static void set_utilization(Wt::WStandardItem *tmp, int val)
 }
 
 
-Wt::WStandardItem* hs::utilization::add_row(Wt::WStandardItem *parent, int row, const vector<string> &cols)
-{
-  Wt::WStandardItem *item = nullptr;
-  int rows = parent->rowCount();
-  if (row >= rows) {
-    item = new Wt::WStandardItem();
-    item->setData(cols[0], Wt::DisplayRole);
-    parent->setChild(row, 0, item);
-    for (int col = 1; col < stat_columns; ++col) {
-      Wt::WStandardItem *tmp = new Wt::WStandardItem();
-      int val = boost::lexical_cast<int>(cols[col]);
-      tmp->setData(val, Wt::DisplayRole);
-      if (col == 2 && parent ==  m_stats.invisibleRootItem()) {
-        set_utilization(tmp, val);
-      }
-      parent->setChild(row, col, tmp);
-    }
-  }
-  return item;
-}
-
-
-Wt::WStandardItem* hs::utilization::insert_row(Wt::WStandardItem *parent, int row, const vector<string> &cols)
+Wt::WStandardItem* hs::utilization::insert_row(Wt::WStandardItem *parent, int row, const utilization_stats &us)
 {
   Wt::WStandardItem *item = new Wt::WStandardItem();
-  item->setData(cols[0], Wt::DisplayRole);
+  item->setData(us.name, Wt::DisplayRole);
   parent->insertRow(row, item);
   for (int col = 1; col < stat_columns; ++col) {
     Wt::WStandardItem *tmp = new Wt::WStandardItem();
-    int val = boost::lexical_cast<int>(cols[col]);
+    int val = us.values[col - 1];
     tmp->setData(val, Wt::DisplayRole);
     if (col == 2 && parent ==  m_stats.invisibleRootItem()) {
       set_utilization(tmp, val);
@@ -110,12 +87,12 @@ Wt::WStandardItem* hs::utilization::insert_row(Wt::WStandardItem *parent, int ro
 }
 
 
-void hs::utilization::update_row(Wt::WStandardItem *parent, int row, const vector<string> &cols)
+void hs::utilization::update_row(Wt::WStandardItem *parent, int row, const utilization_stats &us)
 {
-  parent->child(row, 0)->setData(cols[0], Wt::DisplayRole);
   for (int col = 1; col < stat_columns; ++col) {
     Wt::WStandardItem *tmp = parent->child(row, col);
-    int val = boost::lexical_cast<int>(cols[col]);
+    int val = us.values[col - 1];
+    if (boost::any_cast<int>(tmp->data(Wt::DisplayRole)) == val) continue;
     tmp->setData(val, Wt::DisplayRole);
     if (col == 2 && parent ==  m_stats.invisibleRootItem()) {
       set_utilization(tmp, val);
@@ -124,73 +101,110 @@ void hs::utilization::update_row(Wt::WStandardItem *parent, int row, const vecto
 }
 
 
-void hs::utilization::load_stats()
+/**
+ * Marks the elements of the longest strictly increasing subsequence.
+ */
+static vector<char> longest_increasing(const vector<int> &seq)
 {
-  if (m_hs_cfg->m_utilization.empty()) {
-    return;
+  vector<int> tails; // index into seq of the smallest tail of each length
+  vector<int> prev(seq.size(), -1);
+  for (size_t i = 0; i < seq.size(); ++i) {
+    auto it = lower_bound(tails.begin(), tails.end(), seq[i],
+                          [&seq](int t, int v) { return seq[t] < v; });
+    if (it != tails.begin()) {
+      prev[i] = *(it - 1);
+    }
+    if (it == tails.end()) {
+      tails.push_back(i);
+    } else {
+      *it = i;
+    }
   }
 
-  bool header = true;
-  int cnt     = 0;
-  string s;
-  ifstream ifs(m_hs_cfg->m_utilization.string().c_str());
-  vector<string> cols;
+  vector<char> in_lis(seq.size(), 0);
+  for (int i = tails.empty() ? -1 : tails.back(); i >= 0; i = prev[i]) {
+    in_lis[i] = 1;
+  }
+  return in_lis;
+}
 
-  Wt::WStandardItem *root = m_stats.invisibleRootItem();
-  Wt::WStandardItem *parent = nullptr;
-  int row  = 0;
-  int rowp = 0;
 
-  while (getline(ifs, s).good()) {
-    boost::split(cols, s, boost::is_any_of("\t"));
-    cnt = cols.size();
-    if (cnt < stat_columns) continue;
+void hs::utilization::sync_rows(Wt::WStandardItem *parent,
+                                const vector<const utilization_stats *> &rows)
+{
+  int n = static_cast<int>(rows.size());
+  unordered_map<string, int> wanted(n);
+  for (int i = 0; i < n; ++i) {
+    wanted.insert(make_pair(rows[i]->name, i)); // duplicates are added as new rows
+  }
 
-    if (header) {
-      header = false;
+  // drop the rows that are no longer wanted, in contiguous runs
+  vector<char> matched(n, 0);
+  vector<int> seq; // wanted index of each kept row, bottom up
+  int run = 0;
+  for (int r = parent->rowCount() - 1; r >= -1; --r) {
+    auto w = wanted.end();
+    if (r >= 0) {
+      w = wanted.find(boost::any_cast<string>(parent->child(r, 0)->data(Wt::DisplayRole)));
+      if (w == wanted.end() || matched[w->second]) {
+        ++run;
+        continue;
+      }
+      matched[w->second] = 1;
+      seq.push_back(w->second);
+    }
+    if (run) {
+      parent->removeRows(r + 1, run);
+      run = 0;
+    }
+  }
+  reverse(seq.begin(), seq.end());
+
+  // the longest run already in order stays put, everything else is moved
+  vector<char> stable = longest_increasing(seq);
+  vector<vector<Wt::WStandardItem *> > taken(n);
+  for (int r = static_cast<int>(seq.size()) - 1; r >= 0; --r) {
+    if (!stable[r]) {
+      taken[seq[r]] = parent->takeRow(r);
+    }
+  }
+
+  for (int i = 0; i < n; ++i) {
+    if (!matched[i]) {
+      insert_row(parent, i, *rows[i]);
       continue;
     }
+    if (!taken[i].empty()) {
+      parent->insertRow(i, taken[i]);
+    }
+    update_row(parent, i, *rows[i]);
+  }
+}
 
-    if (boost::starts_with(cols[0], "analysis.")) {
-      if (!parent) {
-        m_stats.clear();
-        return; // invalid input
-      }
-      if (!add_row(parent, rowp, cols)) {
-        update_row(parent, rowp, cols);
-      }
-      ++rowp;
+
+void hs::utilization::load_stats()
+{
+  shared_ptr<const utilization_snapshot> snapshot = m_collector->get_utilization();
+  if (snapshot == m_snapshot) return;
+  m_snapshot = snapshot;
+
+  // analysis.* rows are the plugins of the preceding analysis thread row (the
+  // order is validated by the collector)
+  vector<const utilization_stats *> threads;
+  vector<vector<const utilization_stats *> > children;
+  for (auto it = snapshot->rows.begin(); it != snapshot->rows.end(); ++it) {
+    if (boost::starts_with(it->name, "analysis.")) {
+      children.back().push_back(&*it);
     } else {
-      if (parent) {
-        if (parent->rowCount() > rowp) {
-          parent->removeRows(rowp, parent->rowCount() - rowp);
-        }
-        parent = nullptr;
-      }
-      if (!add_row(root, row, cols)) {
-        Wt::WStandardItem *item = root->child(row, 0);
-        string name(boost::any_cast<string>(item->data(Wt::DisplayRole)));
-        if (name != cols[0]) {
-          item = find_row(root, cols[0], row + 1);
-          if (item) {
-            update_row(root, item->row(), cols);
-            root->removeRows(row, item->row() - row);
-          } else {
-            insert_row(root, row, cols);
-          }
-        } else {
-          update_row(root, row, cols);
-        }
-      }
-      if (boost::starts_with(cols[0], "analysis")) {
-        parent = root->child(row, 0);
-        rowp = 0;
-      }
-      ++row;
+      threads.push_back(&*it);
+      children.push_back(vector<const utilization_stats *>());
     }
   }
-  if (root->rowCount() > row) {
-    root->removeRows(row, root->rowCount() - row);
+
+  Wt::WStandardItem *root = m_stats.invisibleRootItem();
+  sync_rows(root, threads);
+  for (size_t i = 0; i < threads.size(); ++i) {
+    sync_rows(root->child(static_cast<int>(i), 0), children[i]);
   }
 }
 
@@ -217,8 +231,8 @@ Wt::WTreeView* hs::utilization::create_view()
   m_view->setColumnWidth(4, 75);
   m_view->setColumnWidth(5, 75);
 
-  m_timer.setInterval(6000);
-  m_timer.timeout().connect(this, &hs::utilization::load_stats);
-  m_timer.start();
+  m_subscription = m_collector->subscribe(stats_collector::utilization_file,
+                                          Wt::WApplication::instance()->sessionId(),
+                                          std::bind(&hs::utilization::refresh, this));
   return m_view;
 }
@@ -9,6 +9,7 @@
 #ifndef hindsight_admin_utilization_h_
 #define hindsight_admin_utilization_h_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,9 +18,9 @@
 #include <Wt/WSortFilterProxyModel>
 #include <Wt/WStandardItemModel>
 #include <Wt/WTreeView>
-#include <Wt/WTimer>
 
 #include "hindsight_admin.h"
+#include "stats_collector.h"
 
 namespace mozilla {
 namespace services {
@@ -27,26 +28,32 @@ namespace hindsight {
 
 class utilization : public Wt::WContainerWidget {
 public:
-  utilization(session *s, const hindsight_cfg *cfg);
+  utilization(session *s, const hindsight_cfg *cfg, stats_collector *stats);
+  ~utilization();
 
 private:
   Wt::WTreeView* create_view();
   void load_stats();
+  void refresh();
 
-  Wt::WStandardItem* find_row(Wt::WStandardItem *parent, const std::string &name, int row);
+  /**
+   * Updates the children of parent to match rows (in order) with the fewest
+   * row insertions, moves and removals; rows are matched by name.
+   */
+  void sync_rows(Wt::WStandardItem *parent, const std::vector<const utilization_stats *> &rows);
 
-  Wt::WStandardItem* add_row(Wt::WStandardItem *parent, int row, const std::vector<std::string> &cols);
+  Wt::WStandardItem* insert_row(Wt::WStandardItem *parent, int row, const utilization_stats &us);
 
-  Wt::WStandardItem* insert_row(Wt::WStandardItem *parent, int row, const std::vector<std::string> &cols);
-
-  void update_row(Wt::WStandardItem *parent, int row, const std::vector<std::string> &cols);
+  void update_row(Wt::WStandardItem *parent, int row, const utilization_stats &us);
 
   static const int stat_columns = 6;
   session *m_session;
   const hindsight_cfg *m_hs_cfg;
+  stats_collector *m_collector;
+  int             m_subscription;
+  std::shared_ptr<const utilization_snapshot> m_snapshot;
 
   boost::filesystem::path m_file;
-  Wt::WTimer              m_timer;
   Wt::WStandardItemModel  m_stats;
 
 // pointers managed by the application